@@ -2,6 +2,19 @@
 #include <stdio.h>
 #include <assert.h>
 #include <string.h>
+#include <limits.h>
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#ifdef __linux__
+#include <sys/syscall.h>
+#endif
+#if defined(__x86_64__) && defined(__GNUC__)
+#include <immintrin.h>
+#define VECTOR_SCANS 1
+#endif
 #include "ObjectManager.h"
 
 //-------------------------------------------------------------------------------------
@@ -17,27 +30,529 @@ struct REFERENCE
 };
 typedef struct REFERENCE Reference;
 
-typedef struct NODE Node;
+// A Ref packs the index of its slot in the handle table into the low bits and the
+// generation of that slot into the high bits. Slot 0 is never handed out so NULL_REF
+// can never name an object, and the generation lets us tell a stale Ref apart from
+// the object that later reused its slot.
+#define REF_INDEX_BITS 24
+#define REF_INDEX_MASK ((1UL << REF_INDEX_BITS) - 1)
 
-struct NODE
+// The handle table is carved into fixed-size slabs that are allocated as the
+// table grows and recycled through the free list, so existing entries never move
+// and steady-state inserts and collections never call malloc.
+#define SLAB_BITS 10
+#define SLAB_HANDLES (1UL << SLAB_BITS)
+#define MAX_SLABS ((REF_INDEX_MASK + 1) >> SLAB_BITS)
+#define HANDLE_AT(pool, index) (&(pool)->slabs[(index) >> SLAB_BITS][(index) & (SLAB_HANDLES - 1)])
+
+// Every slab has a side table with a bit per handle for the handles in use, one for the large
+// objects among them and one for the live ones, those the collector keeps: the objects with
+// references in a pool collecting by counts, those reached by the last trace (or inserted
+// since) in a tracing pool. Scans of the table skip handles a word at a time without reading
+// them, or on processors with AVX2 or AVX-512 a vector at a time. See nextSlot.
+#define SLAB_WORDS (SLAB_HANDLES / 64)
+#define USED_SLOTS 0
+#define LARGE_SLOTS 1
+#define LIVE_SLOTS 2
+#define DEAD_LARGE_SLOTS 3
+
+// Every block in the buffer starts with a header so the collector can walk the
+// pool in address order. Payloads are rounded up to whole granules so headers
+// stay aligned. A header whose slot is 0 describes filler rather than an object.
+#define GRANULE OBJECT_GRANULE
+#define ALIGN_UP(n) (((n) + (GRANULE - 1)) & ~(GRANULE - 1))
+#define ALIGN_DOWN(n) ((n) & ~(GRANULE - 1))
+#define HEADER_SIZE ((int) sizeof(BlockHeader))
+#define BLOCK_SIZE(size) (HEADER_SIZE + ALIGN_UP(size))
+
+// An object can ask for its payload to start on a multiple of a power of two of up to
+// MAX_ALIGNMENT bytes, the buffer itself starts on a page. Room for such an object is
+// reserved with ALIGN_SLACK extra bytes, and the bytes in front of it are left as filler.
+#define MAX_ALIGNMENT 4096
+#define ALIGN_SLACK(alignment) ((alignment) > GRANULE ? (alignment) - GRANULE : 0)
+
+// Objects of largeObjectSize bytes or more live in pages mapped for them alone, outside the
+// buffer and out of the way of every compaction, see setPoolLargeObjectSize.
+#define IS_LARGE(pool, size) ((pool)->largeObjectSize > 0 && (size) >= (pool)->largeObjectSize)
+#define OBJECT_AT(pool, handle) ((handle)->large != NULL_REF ? (handle)->large : &(pool)->buffer[(handle)->ref.address])
+
+// Threads using a concurrent pool announce themselves in one of a fixed number of
+// reader shards, each on its own cache line, so mutators never write a shared line
+// just to say they are inside the pool. A collector waits for every shard to drain.
+#define READER_SHARDS 64
+#define CACHE_LINE 64
+
+// How many pool accesses one thread can hold at the same time.
+#define MAX_HELD_ACCESS 16
+
+// Threads in a concurrent pool bump allocate small objects from a chunk of the pool
+// they reserved for themselves, and take handles from a small private batch, so the
+// shared allocation lock is only taken to refill. A chunk is at most TLAB_SIZE bytes
+// and at most 1/TLAB_SHARE of the pool. Objects bigger than 1/TLAB_FRACTION of a
+// chunk go straight to the shared pool.
+#define TLAB_SIZE (32*1024)
+#define TLAB_SHARE 128
+#define TLAB_FRACTION 4
+#define HANDLE_BATCH 32
+
+// Objects freed by a thread of a concurrent pool are queued on its shard and handed
+// to the free lists in batches, so dropping a last reference rarely takes a lock.
+#define PENDING_FREES 16
+
+// Blocks of objects whose count dropped to zero are kept in segregated free lists
+// so inserts can reuse them straight away. Blocks of fewer than SMALL_CLASSES
+// granules have one list per exact size, bigger ones one list per power of two.
+// The link to the next free block is kept in the free block itself, so blocks
+// without room for it are left as filler until the next compaction.
+#define SMALL_CLASSES 32
+#define SIZE_CLASSES 64
+#define MIN_FREE_BLOCK (HEADER_SIZE + (int) sizeof(int))
+#define NO_BLOCK (-1)
+#define NEXT_FREE(pool, offset) (*(int*) &(pool)->buffer[(offset) + HEADER_SIZE])
+
+// In a generational pool new objects go into a nursery at the bottom of the buffer.
+// A minor collection only walks the nursery, sliding survivors down and promoting
+// those that survived promotionAge minor collections into the old space above it.
+// Objects bigger than 1/NURSERY_FRACTION of the nursery start out old.
+#define NURSERY_FRACTION 4
+#define GENERATIONAL(pool) ((pool)->nursery.end > (pool)->nursery.start)
+#define IN_NURSERY(pool, handle) ((handle)->large == NULL_REF \
+    && (handle)->ref.address >= (pool)->nursery.start && (handle)->ref.address < (pool)->nursery.end)
+
+// A generational tracing pool remembers the old objects that may point into the nursery, so
+// a minor collection traces from them instead of from the whole pool. The set starts with
+// room for FIRST_REMEMBERED objects and doubles when full.
+#define FIRST_REMEMBERED 256
+
+// With a pause budget the old space is compacted a slice at a time. A cycle starts once
+// the old space is 1/PACING_FILL_SHARE short of full with at least 1/PACING_FREE_SHARE
+// of it on the free lists, and every insert then runs one step until the cycle is done.
+// A step looks at the clock every DEADLINE_CHECK blocks.
+#define PACING_FILL_SHARE 4
+#define PACING_FREE_SHARE 16
+#define DEADLINE_CHECK 16
+
+// A background collector steps for the pause budget, or BACKGROUND_STEP_MICROS without
+// one, and looks for work every BACKGROUND_POLL_MICROS when nobody wakes it sooner.
+#define BACKGROUND_STEP_MICROS 100
+#define BACKGROUND_POLL_MICROS 1000
+
+// A growable pool reserves address space for its maximum size up front and commits
+// pages as it grows, so objects never move because of growth. It grows, doubling up
+// to the maximum, when a full compaction leaves less than 1/GROW_FREE_SHARE of the
+// old space free or cannot make room for an insert.
+#define GROW_FREE_SHARE 4
+
+// After a compaction the pages above the live data, past the first retainBytes of them,
+// are handed back to the system. Pools of a huge page or more are aligned to HUGE_PAGE
+// so transparent huge pages can back them when asked for.
+#define DEFAULT_RETAIN_BYTES (1024*1024)
+#define HUGE_PAGE (2*1024*1024)
+
+// A recording pool buffers this many calls before writing them to its file.
+#define RECORDING_BUFFER_CALLS 4096
+
+// Collections a trace buffer expects to be nested on one thread at most, deeper ones are
+// closed with a generic name when they are still open at the end of a trace.
+#define TRACE_DEPTH 8
+
+// A pool can collect with up to MAX_GC_THREADS threads, the collecting thread and helpers.
+// When marking they steal grey objects from each other's deques. Pools with fewer than
+// PARALLEL_MARK_HANDLES handles are marked by the collecting thread alone, as waking the
+// helpers would take longer. Deques start with room for MARK_DEQUE_SIZE objects and double.
+#define MAX_GC_THREADS 64
+#define PARALLEL_MARK_HANDLES 4096
+#define MARK_DEQUE_SIZE 1024
+
+// A full compaction of an old space of PARALLEL_SLIDE_BYTES or more splits it into regions
+// of SLIDE_REGION_BYTES. The GC threads add up the live bytes of each region, a prefix sum
+// gives every region the offset its objects slide to, and the threads then slide the regions,
+// each waiting only for the regions below it that it slides into.
+#define PARALLEL_SLIDE_BYTES (256*1024)
+#define SLIDE_REGION_BYTES (32*1024)
+
+// In a pool grouping hot objects, an object retrieved HOT_ACCESSES times since its count was
+// last halved is hot. Counting stops at HOT_ACCESS_LIMIT so hot objects are not written to
+// on every read.
+#define HOT_ACCESSES 4
+#define HOT_ACCESS_LIMIT 16
+
+typedef struct HANDLE Handle;
+
+struct HANDLE
 {
     Reference ref;
-    Node* next;
+    unsigned long generation;
+    unsigned long nextFree;
+    int inUse;
+
+    // number of minor collections the object has survived
+    int age;
+
+    // number of pinObject calls not yet undone, a pinned object never moves
+    int pins;
+
+    // number of Refs at the start of the object the collector follows in a tracing pool
+    int slots;
+
+    // non-zero while the object is in the remembered set, see rememberObject
+    int remembered;
+
+    // retrieves of the object in a pool grouping hot objects, halved by every full compaction
+    unsigned int accesses;
+
+    // the pages of an object in the large-object space, NULL for objects in the buffer
+    unsigned char* large;
+
+    // what the address of the object is a multiple of, kept when the collector moves it
+    int alignment;
+};
+
+typedef struct SLAB_SIDE_TABLE SlabBits;
+
+typedef unsigned long (*SkipWords)( const unsigned long *words, const unsigned long *masked, unsigned long word );
+
+struct SLAB_SIDE_TABLE
+{
+    unsigned long used[SLAB_WORDS];
+    unsigned long large[SLAB_WORDS];
+    unsigned long live[SLAB_WORDS];
+};
+
+typedef struct READER_SHARD ReaderShard;
+
+struct READER_SHARD
+{
+    int readers;
+
+    // guards the rest of the shard, threads only share a shard when there are many
+    int lock;
+
+    // the unused part of the chunk this shard allocates from
+    int tlabTop;
+    int tlabEnd;
+
+    // handles reserved for this shard, linked through nextFree
+    unsigned long handleCache;
+
+    // objects inserted through this shard
+    unsigned long objects;
+
+    // handles of objects freed through this shard, not yet on the free lists
+    unsigned int pendingFrees[PENDING_FREES];
+    int pendingCount;
+} __attribute__((aligned(CACHE_LINE)));
+
+typedef struct MARK_ARRAY MarkArray;
+
+// The ring a mark deque keeps its objects in. Arrays outgrown during a mark are kept on
+// the retired list until it ends, as a thief may still be reading them.
+struct MARK_ARRAY
+{
+    long capacity;
+    MarkArray* retired;
+    unsigned long items[];
+};
+
+typedef struct GC_WORKER GcWorker;
+
+// One GC thread and the deque of grey objects it owns when marking. The owner pushes and
+// takes at the bottom, other threads steal from the top. Worker 0 is the collecting thread.
+struct GC_WORKER
+{
+    long top;
+    long bottom;
+    MarkArray* array;
+
+    ObjectPool* pool;
+    int id;
+    pthread_t thread;
+
+    // the last helperRound the worker ran, the round it was started in to begin with
+    unsigned long round;
+} __attribute__((aligned(CACHE_LINE)));
+
+typedef struct SPACE Space;
+
+// A part of the buffer that is bump allocated from start towards end.
+struct SPACE
+{
+    int start;
+    int top;
+    int end;
+};
+
+// What one collection did, for the stats it prints.
+typedef struct COLLECTION_COUNTS CollectionCounts;
+
+struct COLLECTION_COUNTS
+{
+    int bytesUsed;
+    int bytesCollected;
+    int bytesMoved;
+    int bytesReleased;
+};
+
+typedef struct SLIDE_REGION SlideRegion;
+
+// What the GC threads know about one region of a parallel compaction.
+struct SLIDE_REGION
+{
+    // the first block starting in the region, and the first one after it
+    int first;
+    int end;
+
+    // bytes of live blocks in the region, and where the first of them slides to
+    int live;
+    int dest;
+
+    // the lowest region holding blocks that dest lands on, it and those above must be slid first
+    int below;
+
+    // set when the region holds a pinned object or one aligned past a granule, as the serial
+    // slide works around pins and pads aligned objects wherever they land
+    int serial;
+
+    // set once the region has been slid, so regions sliding into it can start
+    int done;
+
+    // what sliding the region did
+    CollectionCounts counts;
+
+    // handles of the dead objects of the region, linked through nextFree
+    unsigned long releasedFirst;
+    unsigned long releasedLast;
+};
+
+typedef struct BLOCK_HEADER BlockHeader;
+
+struct BLOCK_HEADER
+{
+    int size;
+    unsigned int slot;
+};
+
+// the header promises callers this overhead, the build fails if the two ever differ
+typedef char HEADER_SIZE_CHECK[sizeof(BlockHeader) == OBJECT_HEADER_SIZE ? 1 : -1];
+
+// Everything that belongs to one pool. Pools share nothing, so each one can be
+// collected without disturbing the others.
+struct OBJECT_POOL
+{
+    // the object pool, objects are moved within it when compacting
+    unsigned char* buffer;
+
+    // number of bytes in the buffer that are committed and can hold objects
+    int size;
+
+    // number of bytes reserved for the buffer, the most it can grow to
+    int reserved;
+
+    // free bytes above the live data kept resident after a compaction
+    int retainBytes;
+
+    // highest the old space top reached since its tail was last given back
+    int highWater;
+
+    // whether transparent huge pages were asked for
+    int hugePages;
+
+    // where long lived objects live, the whole buffer unless the pool is generational
+    Space old;
+
+    // where new objects go in a generational pool, empty otherwise
+    Space nursery;
+
+    // minor collections an object survives before it is promoted
+    int promotionAge;
+
+    // set when liveness is decided by tracing from the objects with references
+    int tracing;
+
+    // set when retrieves are counted and full compactions move hot objects next to each other
+    int hotGrouping;
+
+    // objects this big or bigger get pages of their own, 0 keeps every object in the buffer
+    int largeObjectSize;
+
+    // the alignment of objects inserted without asking for one
+    int alignment;
+
+    // objects in the large-object space, so collections of pools without any skip the sweep
+    unsigned long largeObjects;
+
+    // handles still to be scanned by a trace, room for every handle in the table
+    unsigned long* markStack;
+    unsigned long markCapacity;
+
+    // old objects that may point into the nursery of a generational tracing pool, until
+    // rememberedOverflow says an object could not be added and a minor collection traces it all
+    unsigned long* rememberedSet;
+    unsigned long rememberedCount;
+    unsigned long rememberedCapacity;
+    int rememberedOverflow;
+
+    // threads that share the work of a collection, gcThreads of them when there is more than one
+    GcWorker* gcWorkers;
+    int gcThreads;
+
+    // helpers run helperTask when helperRound changes, then the last one done signals helperDone
+    void (*helperTask)( ObjectPool *pool, const int id );
+    pthread_mutex_t helperLock;
+    pthread_cond_t helperWake;
+    pthread_cond_t helperDone;
+    unsigned long helperRound;
+    int helperPending;
+    int helperStop;
+
+    // the regions of a parallel compaction, handed out in address order through nextSlideRegion
+    SlideRegion* slideRegions;
+    int slideRegionCount;
+    int nextSlideRegion;
+
+    // mark threads out of work, the mark is over once all of them are
+    int markIdle;
+
+    // set when a deque could not grow, an object was marked but not scanned
+    int markOverflow;
+
+    // handle table, a directory of slabs indexed by the slot part of a Ref
+    Handle **slabs;
+
+    // the side tables of the slabs, one per slab
+    SlabBits **slabBits;
+
+    // finds the first word of a side table from word on with a bit set that masked has not,
+    // with the widest vectors the processor has unless vector scans were turned off
+    SkipWords skipWords;
+
+    // number of slabs allocated so far
+    unsigned long slabCount;
+
+    // slots below this index have been handed out at least once
+    unsigned long handlesUsed;
+
+    // head of the list of released slots (0 when empty)
+    unsigned long freeHandle;
+
+    // object, not counting those inserted through thread-local chunks
+    unsigned long totalObjects;
+
+    // size of the chunks handed to threads of a concurrent pool
+    int tlabSize;
+
+    // first free block of each size class (NO_BLOCK when empty)
+    int freeLists[SIZE_CLASSES];
+
+    // bit set for every size class that has a free block
+    unsigned long long freeClasses;
+
+    // bytes held by the free lists
+    int freeBytes;
+
+    // number of collections run so far
+    unsigned long collections;
+
+    // microseconds one compaction step may take, 0 compacts everything at once when full
+    long pauseBudget;
+
+    // set when inserts should run compaction steps
+    int stepDue;
+
+    // whether a compaction of the old space is under way
+    int compacting;
+
+    // blocks below slideDest are compacted, blocks from slideScan on are still to be visited
+    int slideScan;
+    int slideDest;
+
+    // what the compaction under way has done so far
+    CollectionCounts cycleCounts;
+
+    // counters read by poolGetStats, updated by the collector
+    PoolStats stats;
+
+    // whether every collection prints what it did
+    int verbose;
+
+    // inserts that found the pool full, counted outside of any collection
+    unsigned long allocationFailures;
+
+    // called with every event of the pool when set
+    GcEventHook eventHook;
+    void* eventContext;
+
+    // calls made on the pool are written here when set, see setPoolRecording
+    FILE* recording;
+    struct timespec recordingStarted;
+    PoolCall* recordedCalls;
+    int recordedCount;
+    pthread_mutex_t recordingLock;
+
+    // set when the pool is shared between threads
+    int concurrent;
+
+    // set while a collector has, or is waiting for, exclusive access
+    int collecting;
+
+    // serializes bump allocation and the handle free list
+    pthread_mutex_t allocLock;
+
+    // held by the collector for the whole of a collection
+    pthread_mutex_t gcLock;
+
+    // background collector thread, running while collectorRunning is set
+    pthread_t collector;
+    int collectorRunning;
+    int collectorStop;
+    pthread_mutex_t collectorLock;
+    pthread_cond_t collectorWake;
+
+    // threads currently inside the pool
+    ReaderShard shards[READER_SHARDS];
+};
+
+typedef struct TRACE_RECORD TraceRecord;
+
+// An event kept by a trace buffer and the thread it happened on.
+struct TRACE_RECORD
+{
+    GcEvent event;
+    int thread;
+};
+
+struct TRACE_BUFFER
+{
+    // the last capacity events, recorded counts every event so far
+    TraceRecord *records;
+    unsigned long capacity;
+    unsigned long recorded;
+
+    pthread_mutex_t lock;
 };
 
+typedef struct TRACE_THREAD TraceThread;
+
+// The collections a thread has begun and not yet ended, while a trace is written out.
+struct TRACE_THREAD
+{
+    int thread;
+    int depth;
+    const char *open[TRACE_DEPTH];
+};
 
 //------------------------------------------------------
 // createReference
 //
-// PURPOSE: Creates a new references to be inserted into our linked list.
+// PURPOSE: Creates a new references to be stored in our handle table.
 // INPUT PARAMETERS:
-// size - The size of the object that is being inserted into the list
+// size - The size of the object that is being inserted into the table
 // address - The offset in the buffer were the object lives
 // id - The unique id of the object
 // count - The current count of the object.
 // object pool.
 // OUTPUT PARAMETERS:
-// A new reference to be insted into the list
+// A new reference to be stored in the table
 //------------------------------------------------------
 static Reference createReference(const int size, const int address, const Ref id, const int count)
 {
@@ -49,442 +564,5505 @@ static Reference createReference(const int size, const int address, const Ref id
     return reference1;
 }
 
+//-------------------------------------------------------------------------------------
+// VARIABLES
+//-------------------------------------------------------------------------------------
+
+// the pool used by the functions that do not take one
+static ObjectPool *defaultPool = NULL;
+
+// used to spread threads over the reader shards
+static int nextShard = 0;
+
+// the reader shard of the current thread (-1 until first use)
+static __thread int threadShard = -1;
+
+// pools the current thread holds access to through beginPoolAccess
+static __thread ObjectPool *heldPools[MAX_HELD_ACCESS];
+static __thread int heldCount = 0;
+
+// the id of the current thread in traces (0 until first use)
+static __thread int traceThread = 0;
+
+//-------------------------------------------------------------------------------------
+// HANDLE TABLE
+//-------------------------------------------------------------------------------------
+
+//------------------------------------------------------
+// makeRef
+//
+// PURPOSE: Builds the public reference for a slot.
+// INPUT PARAMETERS:
+// index - The slot in the handle table
+// generation - The number of times the slot has been reused
+// OUTPUT PARAMETERS:
+// The reference handed out to callers.
+//------------------------------------------------------
+static Ref makeRef(const unsigned long index, const unsigned long generation)
+{
+    return ((Ref) generation << REF_INDEX_BITS) | (index & REF_INDEX_MASK);
+}
+
 //------------------------------------------------------
-// createNode
+// findHandle
 //
-// PURPOSE: Creates a new node to be placed within our linked list
+// PURPOSE: Looks up the slot for a reference in constant time.
 // INPUT PARAMETERS:
-// ref - The reference that is attached to the currnet object
-// next - The next node in the linked list
+// pool - The pool that owns the reference
+// ref - The reference we are looking for
 // OUTPUT PARAMETERS:
-// Either a new node or NULL.
+// The handle of the live object or NULL if the reference is
+// unknown or refers to an object that has been reclaimed.
 //------------------------------------------------------
-static Node* createNode(const Reference ref, Node *next)
+static Handle* findHandle(ObjectPool *pool, const Ref ref)
 {
-    // this is an edge case with clang++ were we must cast to the type
-    Node* node = NULL;
+    Handle* handle = NULL;
+    unsigned long index = ref & REF_INDEX_MASK;
+
+    // lookups do not take a lock, the table only grows and a slot publishes its id last
+    if (index > 0 && index < __atomic_load_n(&pool->handlesUsed, __ATOMIC_ACQUIRE))
+    {
+        handle = HANDLE_AT(pool, index);
 
-    node = (Node*) malloc(sizeof(Node));
+        if (__atomic_load_n(&handle->ref.id, __ATOMIC_ACQUIRE) != ref)
+        {
+            handle = NULL;
+        }
+    }
+
+    return handle;
+}
 
-    assert(node != NULL);
+//------------------------------------------------------
+// allocateHandle
+//
+// PURPOSE: Takes a slot from the free list, or a fresh one from
+// the end of the table, growing the table when it is full. The
+// slot is not in use until an object is placed in it.
+// The caller holds the allocation lock.
+// INPUT PARAMETERS:
+// pool - The pool that owns the table
+// OUTPUT PARAMETERS:
+// The index of the slot or 0 if no slot could be allocated.
+//------------------------------------------------------
+static unsigned long allocateHandle(ObjectPool *pool)
+{
+    unsigned long index = 0;
 
-    if (node != NULL_REF)
+    if (pool->freeHandle != 0)
+    {
+        index = pool->freeHandle;
+        pool->freeHandle = HANDLE_AT(pool, index)->nextFree;
+    }
+    else if (pool->handlesUsed <= REF_INDEX_MASK)
     {
-        node->ref = ref;
-        node->next = next;
+        if (pool->slabs == NULL_REF)
+        {
+            // this is an edge case with clang++ were we must cast to the type
+            pool->slabs = (Handle**) calloc(MAX_SLABS, sizeof(Handle*));
+            pool->slabBits = (SlabBits**) calloc(MAX_SLABS, sizeof(SlabBits*));
+
+            if (pool->slabBits == NULL_REF)
+            {
+                free(pool->slabs);
+                pool->slabs = NULL_REF;
+            }
+        }
+
+        if (pool->slabs != NULL_REF && (pool->handlesUsed >> SLAB_BITS) >= pool->slabCount)
+        {
+            Handle* slab = (Handle*) calloc(SLAB_HANDLES, sizeof(Handle));
+            SlabBits* bits = (SlabBits*) calloc(1, sizeof(SlabBits));
+
+            if (slab != NULL_REF && bits != NULL_REF)
+            {
+                pool->slabBits[pool->slabCount] = bits;
+                pool->slabs[pool->slabCount++] = slab;
+            }
+            else
+            {
+                free(slab);
+                free(bits);
+
+                fprintf(stdout, "Failed to allocate a slab of %lu handles\n", SLAB_HANDLES);
+            }
+        }
+
+        if (pool->slabs != NULL_REF && (pool->handlesUsed >> SLAB_BITS) < pool->slabCount)
+        {
+            index = pool->handlesUsed;
+            __atomic_store_n(&pool->handlesUsed, index + 1, __ATOMIC_RELEASE);
+        }
     }
     else
     {
-        fprintf(stdout, "Failed to dynamically allocate memory for new node\n");
+        fprintf(stdout, "Handle table is full.\n");
+    }
+
+    if (index != 0)
+    {
+        HANDLE_AT(pool, index)->nextFree = 0;
     }
 
-    return node;
+    return index;
 }
 
-//-------------------------------------------------------------------------------------
-// VARIABLES
-//-------------------------------------------------------------------------------------
+//------------------------------------------------------
+// setSlotBit
+//
+// PURPOSE: Sets the bit of a handle in one of the bitmaps of its slab.
+// Bits other threads may change at the same time share words, so they
+// are set atomically, others with a plain store.
+// INPUT PARAMETERS:
+// words - The bitmap
+// index - The slot of the handle
+// shared - Non-zero when other threads may change the bitmap
+//------------------------------------------------------
+static void setSlotBit(unsigned long *words, const unsigned long index, const int shared)
+{
+    unsigned long word = (index & (SLAB_HANDLES - 1)) / 64;
+
+    if (shared)
+    {
+        __atomic_fetch_or(&words[word], 1UL << (index % 64), __ATOMIC_SEQ_CST);
+    }
+    else
+    {
+        words[word] |= 1UL << (index % 64);
+    }
+}
+
+//------------------------------------------------------
+// clearSlotBit
+//
+// PURPOSE: Clears the bit of a handle in one of the bitmaps of its slab.
+// INPUT PARAMETERS:
+// words - The bitmap
+// index - The slot of the handle
+// shared - Non-zero when other threads may change the bitmap
+//------------------------------------------------------
+static void clearSlotBit(unsigned long *words, const unsigned long index, const int shared)
+{
+    unsigned long word = (index & (SLAB_HANDLES - 1)) / 64;
+
+    if (shared)
+    {
+        __atomic_fetch_and(&words[word], ~(1UL << (index % 64)), __ATOMIC_SEQ_CST);
+    }
+    else
+    {
+        words[word] &= ~(1UL << (index % 64));
+    }
+}
 
-// used for id generation
-static unsigned long references = 0;
+//------------------------------------------------------
+// setSlotBits
+//
+// PURPOSE: Notes in the side table of its slab that a handle is in
+// use and live, and whether it holds a large object. Threads placing
+// objects from their own handles share words in a concurrent pool.
+// INPUT PARAMETERS:
+// pool - The pool that owns the table
+// index - The slot of the handle
+// large - Non-zero when the handle holds a large object
+//------------------------------------------------------
+static void setSlotBits(ObjectPool *pool, const unsigned long index, const int large)
+{
+    SlabBits* bits = pool->slabBits[index >> SLAB_BITS];
 
-// We will use double buffering
-unsigned char* buffer;
+    setSlotBit(bits->used, index, pool->concurrent);
+    setSlotBit(bits->live, index, pool->concurrent);
 
-// free ptr location
-int freePtr = 0;
+    if (large)
+    {
+        setSlotBit(bits->large, index, pool->concurrent);
+    }
+}
 
-// linked list
-Node *top;
+//------------------------------------------------------
+// clearSlotBits
+//
+// PURPOSE: Notes in the side table of its slab that a handle is free.
+// INPUT PARAMETERS:
+// pool - The pool that owns the table
+// index - The slot of the handle
+// shared - Non-zero when other threads may change the table
+//------------------------------------------------------
+static void clearSlotBits(ObjectPool *pool, const unsigned long index, const int shared)
+{
+    SlabBits* bits = pool->slabBits[index >> SLAB_BITS];
 
-// object
-unsigned long totalObjects = 0;
+    clearSlotBit(bits->used, index, shared);
+    clearSlotBit(bits->large, index, shared);
+    clearSlotBit(bits->live, index, shared);
+}
 
-//-------------------------------------------------------------------------------------
-// FUNCTIONS
-//-------------------------------------------------------------------------------------
+//------------------------------------------------------
+// liveSlot
+//
+// PURPOSE: Tells from the side table whether the collector keeps the
+// object of a handle. Counts may be changing when stats are taken, so
+// the bit is read atomically.
+// INPUT PARAMETERS:
+// pool - The pool that owns the table
+// index - The slot of the handle
+// OUTPUT PARAMETERS:
+// Non-zero when the object is live.
+//------------------------------------------------------
+static int liveSlot(ObjectPool *pool, const unsigned long index)
+{
+    return (__atomic_load_n(&pool->slabBits[index >> SLAB_BITS]->live[(index & (SLAB_HANDLES - 1)) / 64], __ATOMIC_RELAXED)
+        >> (index % 64)) & 1;
+}
 
 //------------------------------------------------------
-// verifyState
+// skipWordsScalar
 //
-// PURPOSE: Verifies the state of the object pool to enusre
-// that it's valid when modifying values upon it.
+// PURPOSE: Finds the first word of a side table from word on with a
+// bit set that masked has not, a word at a time.
+// INPUT PARAMETERS:
+// words - The bitmap
+// masked - The bits that do not count
+// word - The first word to look at
+// OUTPUT PARAMETERS:
+// The word found, or SLAB_WORDS if there is none.
+//------------------------------------------------------
+static unsigned long skipWordsScalar(const unsigned long *words, const unsigned long *masked, unsigned long word)
+{
+    while (word < SLAB_WORDS && (words[word] & ~masked[word]) == 0)
+    {
+        word++;
+    }
+
+    return word;
+}
+
+#ifdef VECTOR_SCANS
+//------------------------------------------------------
+// skipWordsAvx2
+//
+// PURPOSE: Does what skipWordsScalar does four words at a time.
+// INPUT PARAMETERS:
+// words - The bitmap
+// masked - The bits that do not count
+// word - The first word to look at
+// OUTPUT PARAMETERS:
+// The word found, or SLAB_WORDS if there is none.
+//------------------------------------------------------
+__attribute__((target("avx2")))
+static unsigned long skipWordsAvx2(const unsigned long *words, const unsigned long *masked, unsigned long word)
+{
+    while (word + 4 <= SLAB_WORDS
+        && _mm256_testz_si256(_mm256_loadu_si256((const __m256i*) &words[word]),
+            _mm256_andnot_si256(_mm256_loadu_si256((const __m256i*) &masked[word]), _mm256_set1_epi64x(-1))))
+    {
+        word += 4;
+    }
+
+    return skipWordsScalar(words, masked, word);
+}
+
+//------------------------------------------------------
+// skipWordsAvx512
+//
+// PURPOSE: Does what skipWordsScalar does eight words at a time.
+// INPUT PARAMETERS:
+// words - The bitmap
+// masked - The bits that do not count
+// word - The first word to look at
+// OUTPUT PARAMETERS:
+// The word found, or SLAB_WORDS if there is none.
+//------------------------------------------------------
+__attribute__((target("avx512f")))
+static unsigned long skipWordsAvx512(const unsigned long *words, const unsigned long *masked, unsigned long word)
+{
+    while (word + 8 <= SLAB_WORDS
+        && _mm512_test_epi64_mask(_mm512_loadu_si512(&words[word]),
+            _mm512_andnot_si512(_mm512_loadu_si512(&masked[word]), _mm512_set1_epi64(-1))) == 0)
+    {
+        word += 8;
+    }
+
+    return skipWordsScalar(words, masked, word);
+}
+#endif
+
+//------------------------------------------------------
+// chooseSkipWords
+//
+// PURPOSE: Picks the widest scan of the side tables the processor can
+// run, whatever flags the library was compiled with.
+// INPUT PARAMETERS:
+// vectors - Non-zero to use vectors where the processor has them
+// OUTPUT PARAMETERS:
+// The scan.
+//------------------------------------------------------
+static SkipWords chooseSkipWords(const int vectors)
+{
+#ifdef VECTOR_SCANS
+    if (vectors && __builtin_cpu_supports("avx512f"))
+    {
+        return skipWordsAvx512;
+    }
+
+    if (vectors && __builtin_cpu_supports("avx2"))
+    {
+        return skipWordsAvx2;
+    }
+#else
+    (void) vectors;
+#endif
+
+    return skipWordsScalar;
+}
+
+// the mask of scans that count every bit
+static const unsigned long noSlots[SLAB_WORDS];
+
+//------------------------------------------------------
+// nextSlot
+//
+// PURPOSE: Finds the next handle in use, holding a large object, live
+// or holding a large object that is not live, from the side tables
+// alone. Words without such a bit are skipped whole, several at once
+// where the processor has vectors. The caller has exclusive access.
+// INPUT PARAMETERS:
+// pool - The pool that owns the table
+// index - The first slot to look at
+// which - USED_SLOTS, LARGE_SLOTS, LIVE_SLOTS or DEAD_LARGE_SLOTS
+// OUTPUT PARAMETERS:
+// The slot found, or handlesUsed if there is none.
+//------------------------------------------------------
+static unsigned long nextSlot(ObjectPool *pool, unsigned long index, const int which)
+{
+    while (index < pool->handlesUsed)
+    {
+        SlabBits* bits = pool->slabBits[index >> SLAB_BITS];
+        const unsigned long* words = which == USED_SLOTS ? bits->used : which == LIVE_SLOTS ? bits->live : bits->large;
+        const unsigned long* masked = which == DEAD_LARGE_SLOTS ? bits->live : noSlots;
+        unsigned long word = (index & (SLAB_HANDLES - 1)) / 64;
+        unsigned long pending = words[word] & ~masked[word] & (~0UL << (index % 64));
+
+        if (pending != 0)
+        {
+            return (index & ~63UL) + (unsigned long) __builtin_ctzl(pending);
+        }
+
+        word = pool->skipWords(words, masked, word + 1);
+        index = (index & ~(SLAB_HANDLES - 1)) + word * 64;
+    }
+
+    return pool->handlesUsed;
+}
+
+//------------------------------------------------------
+// releaseHandle
+//
+// PURPOSE: Returns a slot to the free list. Bumping the generation
+// makes any reference still naming the old object stale.
+// The caller has exclusive access to the pool or holds the
+// allocation lock.
+// INPUT PARAMETERS:
+// pool - The pool that owns the table
+// index - The slot being released
+//------------------------------------------------------
+static void releaseHandle(ObjectPool *pool, const unsigned long index)
+{
+    Handle* handle = HANDLE_AT(pool, index);
+
+    assert(index > 0 && index < pool->handlesUsed);
+    assert(handle->inUse);
+
+    handle->inUse = 0;
+    handle->generation++;
+    __atomic_store_n(&handle->ref.id, NULL_REF, __ATOMIC_RELAXED);
+    handle->nextFree = pool->freeHandle;
+    pool->freeHandle = index;
+
+    clearSlotBits(pool, index, pool->concurrent);
+}
+
+//-------------------------------------------------------------------------------------
+// SYNCHRONIZATION
+//-------------------------------------------------------------------------------------
+
+//------------------------------------------------------
+// holdsAccess
+//
+// PURPOSE: Checks whether the current thread holds access to a pool.
+// INPUT PARAMETERS:
+// pool - The pool to check for, or NULL for any pool
+// OUTPUT PARAMETERS:
+// Non-zero when the thread holds the access.
+//------------------------------------------------------
+static int holdsAccess(ObjectPool *pool)
+{
+    int held = 0;
+    int i;
+
+    for (i = 0; i < heldCount && !held; i++)
+    {
+        held = (pool == NULL || heldPools[i] == pool);
+    }
+
+    return held;
+}
+
+//------------------------------------------------------
+// enterPool
+//
+// PURPOSE: Marks the current thread as working inside a concurrent
+// pool, waiting first for any collection in progress to finish.
+// INPUT PARAMETERS:
+// pool - The pool being entered
+//------------------------------------------------------
+static void enterPool(ObjectPool *pool)
+{
+    if (pool->concurrent)
+    {
+        ReaderShard* shard;
+        int held = holdsAccess(pool);
+
+        if (threadShard < 0)
+        {
+            threadShard = __atomic_fetch_add(&nextShard, 1, __ATOMIC_RELAXED) % READER_SHARDS;
+        }
+
+        shard = &pool->shards[threadShard];
+
+        for (;;)
+        {
+            __atomic_add_fetch(&shard->readers, 1, __ATOMIC_SEQ_CST);
+
+            // a thread that already holds access keeps the collector out anyway
+            if (held || !__atomic_load_n(&pool->collecting, __ATOMIC_SEQ_CST))
+            {
+                break;
+            }
+
+            __atomic_sub_fetch(&shard->readers, 1, __ATOMIC_SEQ_CST);
+
+            // the collector holds gcLock until it is done
+            pthread_mutex_lock(&pool->gcLock);
+            pthread_mutex_unlock(&pool->gcLock);
+        }
+    }
+}
+
+//------------------------------------------------------
+// leavePool
+//
+// PURPOSE: Marks the current thread as no longer working inside
+// a concurrent pool.
+// INPUT PARAMETERS:
+// pool - The pool being left
+//------------------------------------------------------
+static void leavePool(ObjectPool *pool)
+{
+    if (pool->concurrent)
+    {
+        __atomic_sub_fetch(&pool->shards[threadShard].readers, 1, __ATOMIC_RELEASE);
+    }
+}
+
+//------------------------------------------------------
+// beginExclusive
+//
+// PURPOSE: Waits until no other thread is working inside the pool
+// and keeps new threads out until endExclusive.
+// INPUT PARAMETERS:
+// pool - The pool being locked
+//------------------------------------------------------
+static void beginExclusive(ObjectPool *pool)
+{
+    if (pool->concurrent)
+    {
+        int shard;
+
+        pthread_mutex_lock(&pool->gcLock);
+        __atomic_store_n(&pool->collecting, 1, __ATOMIC_SEQ_CST);
+
+        for (shard = 0; shard < READER_SHARDS; shard++)
+        {
+            while (__atomic_load_n(&pool->shards[shard].readers, __ATOMIC_SEQ_CST) != 0)
+            {
+                sched_yield();
+            }
+        }
+    }
+}
+
+//------------------------------------------------------
+// endExclusive
+//
+// PURPOSE: Lets threads back into the pool after beginExclusive.
+// INPUT PARAMETERS:
+// pool - The pool being unlocked
+//------------------------------------------------------
+static void endExclusive(ObjectPool *pool)
+{
+    if (pool->concurrent)
+    {
+        __atomic_store_n(&pool->collecting, 0, __ATOMIC_RELEASE);
+        pthread_mutex_unlock(&pool->gcLock);
+    }
+}
+
+//------------------------------------------------------
+// lockAllocation / unlockAllocation
+//
+// PURPOSE: Guards the bump pointer and the handle free list when
+// several threads insert into the same pool.
+// INPUT PARAMETERS:
+// pool - The pool being allocated from
+//------------------------------------------------------
+static void lockAllocation(ObjectPool *pool)
+{
+    if (pool->concurrent)
+    {
+        pthread_mutex_lock(&pool->allocLock);
+    }
+}
+
+static void unlockAllocation(ObjectPool *pool)
+{
+    if (pool->concurrent)
+    {
+        pthread_mutex_unlock(&pool->allocLock);
+    }
+}
+
+//------------------------------------------------------
+// lockShard / unlockShard
+//
+// PURPOSE: Guards the thread-local chunk and handles of a shard. The
+// lock is almost never contended so a spin is enough.
+// INPUT PARAMETERS:
+// shard - The shard being used
+//------------------------------------------------------
+static void lockShard(ReaderShard *shard)
+{
+    while (__atomic_exchange_n(&shard->lock, 1, __ATOMIC_ACQUIRE))
+    {
+        sched_yield();
+    }
+}
+
+static void unlockShard(ReaderShard *shard)
+{
+    __atomic_store_n(&shard->lock, 0, __ATOMIC_RELEASE);
+}
+
+//------------------------------------------------------
+// beginInspection / endInspection
+//
+// PURPOSE: Keeps the handle table of a pool still while it is read,
+// without waiting for the other threads to leave the pool, so a
+// thread that holds access to a pool can still look at it. Entering
+// the pool keeps collections out, the shard and allocation locks keep
+// out inserts and frees.
+// INPUT PARAMETERS:
+// pool - The pool being read
+//------------------------------------------------------
+static void beginInspection(ObjectPool *pool)
+{
+    int shard;
+
+    enterPool(pool);
+
+    if (pool->concurrent)
+    {
+        for (shard = 0; shard < READER_SHARDS; shard++)
+        {
+            lockShard(&pool->shards[shard]);
+        }
+    }
+
+    lockAllocation(pool);
+}
+
+static void endInspection(ObjectPool *pool)
+{
+    int shard;
+
+    unlockAllocation(pool);
+
+    if (pool->concurrent)
+    {
+        for (shard = 0; shard < READER_SHARDS; shard++)
+        {
+            unlockShard(&pool->shards[shard]);
+        }
+    }
+
+    leavePool(pool);
+}
+
+//-------------------------------------------------------------------------------------
+// FUNCTIONS
+//-------------------------------------------------------------------------------------
+
+//------------------------------------------------------
+// verifyState
+//
+// PURPOSE: Verifies the state of the object pool to enusre
+// that it's valid when modifying values upon it.
+// INPUT PARAMETERS:
+// pool - The pool being verified
+//------------------------------------------------------
+static void verifyState(ObjectPool *pool)
+{
+    assert(pool != NULL);
+    assert(pool->buffer != NULL);
+}
+
+//------------------------------------------------------
+// writeFiller
+//
+// PURPOSE: Covers unused bytes with a block that has no object so
+// the pool can still be walked block by block.
+// INPUT PARAMETERS:
+// pool - The pool being written
+// offset - Where the unused bytes start
+// bytes - How many bytes are unused, a whole number of granules
+//------------------------------------------------------
+static void writeFiller(ObjectPool *pool, const int offset, const int bytes)
+{
+    BlockHeader* header = (BlockHeader*) &pool->buffer[offset];
+
+    assert(bytes >= HEADER_SIZE && bytes == ALIGN_UP(bytes));
+
+    header->size = bytes - HEADER_SIZE;
+    header->slot = 0;
+}
+
+//------------------------------------------------------
+// alignPad
+//
+// PURPOSE: Works out how much filler has to go in front of a block so
+// the object in it starts on its alignment.
+// INPUT PARAMETERS:
+// offset - Where the block would start
+// alignment - The alignment of the object
+// OUTPUT PARAMETERS:
+// The bytes of filler, 0 or at least a header.
+//------------------------------------------------------
+static int alignPad(const int offset, const int alignment)
+{
+    return ((offset + HEADER_SIZE + alignment - 1) & ~(alignment - 1)) - HEADER_SIZE - offset;
+}
+
+//------------------------------------------------------
+// retireBuffer
+//
+// PURPOSE: Gives up what is left of a shard's chunk, turning it into
+// filler the collector can step over.
+// INPUT PARAMETERS:
+// pool - The pool that owns the chunk
+// shard - The shard giving up its chunk
+//------------------------------------------------------
+static void retireBuffer(ObjectPool *pool, ReaderShard *shard)
+{
+    if (shard->tlabEnd > shard->tlabTop)
+    {
+        writeFiller(pool, shard->tlabTop, shard->tlabEnd - shard->tlabTop);
+    }
+
+    shard->tlabTop = 0;
+    shard->tlabEnd = 0;
+}
+
+//------------------------------------------------------
+// countObjects
+//
+// PURPOSE: Adds up the objects inserted into the pool by every thread.
+// INPUT PARAMETERS:
+// pool - The pool being counted
+// OUTPUT PARAMETERS:
+// The number of objects ever inserted.
+//------------------------------------------------------
+static unsigned long countObjects(ObjectPool *pool)
+{
+    unsigned long total = pool->totalObjects;
+    int shard;
+
+    for (shard = 0; shard < READER_SHARDS; shard++)
+    {
+        total += __atomic_load_n(&pool->shards[shard].objects, __ATOMIC_RELAXED);
+    }
+
+    return total;
+}
+
+//------------------------------------------------------
+// sizeClass
+//
+// PURPOSE: Finds the free list that blocks of a given size belong to.
+// INPUT PARAMETERS:
+// blockSize - The size of the block including its header
+// OUTPUT PARAMETERS:
+// The size class of the block.
+//------------------------------------------------------
+static int sizeClass(const int blockSize)
+{
+    int granules = blockSize / GRANULE;
+    int sizeClass = granules;
+
+    if (granules >= SMALL_CLASSES)
+    {
+        int limit = SMALL_CLASSES * 2;
+
+        sizeClass = SMALL_CLASSES;
+
+        while (granules >= limit && limit > 0)
+        {
+            sizeClass++;
+            limit *= 2;
+        }
+    }
+
+    assert(sizeClass < SIZE_CLASSES);
+
+    return sizeClass;
+}
+
+//------------------------------------------------------
+// clearFreeLists
+//
+// PURPOSE: Forgets every free block, compaction reclaims them anyway.
+// INPUT PARAMETERS:
+// pool - The pool whose free lists are cleared
+//------------------------------------------------------
+static void clearFreeLists(ObjectPool *pool)
+{
+    int i;
+
+    for (i = 0; i < SIZE_CLASSES; i++)
+    {
+        pool->freeLists[i] = NO_BLOCK;
+    }
+
+    pool->freeClasses = 0;
+    pool->freeBytes = 0;
+}
+
+//------------------------------------------------------
+// addFreeBlock
+//
+// PURPOSE: Turns a block into filler and, when it has room for the
+// link, puts it on the free list of its size class.
+// The caller holds the allocation lock.
+// INPUT PARAMETERS:
+// pool - The pool that owns the block
+// offset - Where the block starts
+// blockSize - The size of the block including its header
+//------------------------------------------------------
+static void addFreeBlock(ObjectPool *pool, const int offset, const int blockSize)
+{
+    writeFiller(pool, offset, blockSize);
+
+    // the nursery is emptied by the next minor collection, its blocks are not worth tracking,
+    // and blocks the compaction under way has yet to visit are about to be slid over
+    if (blockSize >= MIN_FREE_BLOCK && offset >= pool->old.start
+        && !(pool->compacting && offset >= pool->slideDest))
+    {
+        int list = sizeClass(blockSize);
+
+        NEXT_FREE(pool, offset) = pool->freeLists[list];
+        pool->freeLists[list] = offset;
+        pool->freeClasses |= 1ULL << list;
+        pool->freeBytes += blockSize;
+    }
+}
+
+//------------------------------------------------------
+// takeFreeBlock
+//
+// PURPOSE: Finds a free block big enough for a new block, taking an
+// exact fit when there is one, and splits off what is not needed.
+// The caller holds the allocation lock.
+// INPUT PARAMETERS:
+// pool - The pool being allocated from
+// blockSize - The size of the block needed including its header
+// OUTPUT PARAMETERS:
+// Where the block starts or NO_BLOCK if no free block fits.
+//------------------------------------------------------
+static int takeFreeBlock(ObjectPool *pool, const int blockSize)
+{
+    int offset = NO_BLOCK;
+    int list = sizeClass(blockSize);
+
+    if (pool->freeBytes < blockSize)
+    {
+        return NO_BLOCK;
+    }
+
+    // the power of two classes hold blocks of mixed sizes, so search our own class first
+    if (list >= SMALL_CLASSES && (pool->freeClasses & (1ULL << list)))
+    {
+        int previous = NO_BLOCK;
+        int current = pool->freeLists[list];
+
+        while (current != NO_BLOCK && BLOCK_SIZE(((BlockHeader*) &pool->buffer[current])->size) < blockSize)
+        {
+            previous = current;
+            current = NEXT_FREE(pool, current);
+        }
+
+        if (current != NO_BLOCK)
+        {
+            if (previous == NO_BLOCK)
+            {
+                pool->freeLists[list] = NEXT_FREE(pool, current);
+            }
+            else
+            {
+                NEXT_FREE(pool, previous) = NEXT_FREE(pool, current);
+            }
+
+            offset = current;
+        }
+
+        list++;
+    }
+
+    // every block in the exact class, or in any higher class, is big enough
+    if (offset == NO_BLOCK && list < SIZE_CLASSES && (pool->freeClasses >> list) != 0)
+    {
+        list += __builtin_ctzll(pool->freeClasses >> list);
+
+        offset = pool->freeLists[list];
+        pool->freeLists[list] = NEXT_FREE(pool, offset);
+    }
+
+    if (offset != NO_BLOCK)
+    {
+        int found = BLOCK_SIZE(((BlockHeader*) &pool->buffer[offset])->size);
+        int sizeClassOfFound = sizeClass(found);
+
+        if (pool->freeLists[sizeClassOfFound] == NO_BLOCK)
+        {
+            pool->freeClasses &= ~(1ULL << sizeClassOfFound);
+        }
+
+        pool->freeBytes -= found;
+
+        if (found > blockSize)
+        {
+            addFreeBlock(pool, offset + blockSize, found - blockSize);
+        }
+    }
+
+    return offset;
+}
+
+//------------------------------------------------------
+// flushFrees
+//
+// PURPOSE: Moves the objects a shard has queued for freeing onto the
+// free lists. The caller holds the shard lock or exclusive access.
+// INPUT PARAMETERS:
+// pool - The pool that owns the objects
+// shard - The shard whose queue is flushed
+//------------------------------------------------------
+static void flushFrees(ObjectPool *pool, ReaderShard *shard)
+{
+    int i;
+
+    for (i = 0; i < shard->pendingCount; i++)
+    {
+        Handle* handle = HANDLE_AT(pool, shard->pendingFrees[i]);
+
+        addFreeBlock(pool, handle->ref.address - HEADER_SIZE, BLOCK_SIZE(handle->ref.size));
+
+        releaseHandle(pool, shard->pendingFrees[i]);
+    }
+
+    shard->pendingCount = 0;
+}
+
+//------------------------------------------------------
+// emitEvent
+//
+// PURPOSE: Hands an event to the hook of the pool, if it has one.
+// INPUT PARAMETERS:
+// pool - The pool the event happened in
+// type - One of the GC_EVENT_ types
+// kind - The kind of collection for begin and end events, or NULL
+// ref - The object the event is about, or NULL_REF
+// from - Where a moved object was
+// to - Where a moved object is now
+// bytes - The size of the object, or the new size of a grown pool
+// when - When the event happened, NULL for now
+//------------------------------------------------------
+static void emitEvent(ObjectPool *pool, const int type, const char *kind, const Ref ref,
+    const long from, const long to, const long bytes, const struct timespec *when)
+{
+    if (pool->eventHook != NULL)
+    {
+        GcEvent event;
+        struct timespec now;
+
+        if (when == NULL)
+        {
+            clock_gettime(CLOCK_MONOTONIC, &now);
+            when = &now;
+        }
+
+        event.type = type;
+        event.timestamp = (unsigned long) when->tv_sec * 1000000000UL + (unsigned long) when->tv_nsec;
+        event.kind = kind;
+        event.ref = ref;
+        event.from = from;
+        event.to = to;
+        event.bytes = bytes;
+
+        pool->eventHook(&event, pool->eventContext);
+    }
+}
+
+//------------------------------------------------------
+// flushRecording
+//
+// PURPOSE: Writes the calls buffered by a recording pool to its file.
+// The caller holds the recording lock.
+// INPUT PARAMETERS:
+// pool - The pool being recorded
+//------------------------------------------------------
+static void flushRecording(ObjectPool *pool)
+{
+    if (pool->recordedCount > 0 &&
+        fwrite(pool->recordedCalls, sizeof(PoolCall), pool->recordedCount, pool->recording) != (size_t) pool->recordedCount)
+    {
+        fprintf(stdout, "Failed to write %d calls to the recording.\n", pool->recordedCount);
+    }
+
+    pool->recordedCount = 0;
+}
+
+//------------------------------------------------------
+// recordCall
+//
+// PURPOSE: Adds a call to the recording of a pool, if it is being recorded.
+// INPUT PARAMETERS:
+// pool - The pool the call was made on
+// call - One of the POOL_CALL_ values
+// ref - The object the call was about or the one an insert returned
+// value - The size of an insert, the budget of a collection step or a
+// new default alignment
+// detail - The alignment of an aligned insert, the slots of a traced
+// insert, 0 for other calls
+//------------------------------------------------------
+static void recordCall(ObjectPool *pool, const int call, const Ref ref, const int value, const int detail)
+{
+    if (pool->recording != NULL)
+    {
+        struct timespec now;
+        PoolCall* record;
+
+        clock_gettime(CLOCK_MONOTONIC, &now);
+
+        pthread_mutex_lock(&pool->recordingLock);
+
+        record = &pool->recordedCalls[pool->recordedCount++];
+        memset(record, 0, sizeof(PoolCall));
+        record->timestamp = (unsigned long) (now.tv_sec - pool->recordingStarted.tv_sec) * 1000000000UL
+            + (unsigned long) now.tv_nsec - (unsigned long) pool->recordingStarted.tv_nsec;
+        record->ref = ref;
+        record->value = value;
+        record->call = call;
+        record->detail = detail;
+
+        if (pool->recordedCount == RECORDING_BUFFER_CALLS)
+        {
+            flushRecording(pool);
+        }
+
+        pthread_mutex_unlock(&pool->recordingLock);
+    }
+}
+
+//------------------------------------------------------
+// prepareCollection
+//
+// PURPOSE: Makes the pool walkable before a collection by turning
+// the unused tails of thread-local chunks and queued frees into
+// filler. The caller has exclusive access.
+// INPUT PARAMETERS:
+// pool - The pool about to be collected
+//------------------------------------------------------
+static void prepareCollection(ObjectPool *pool)
+{
+    int shard;
+
+    verifyState(pool);
+
+    if (pool->old.top > pool->highWater)
+    {
+        pool->highWater = pool->old.top;
+    }
+
+    for (shard = 0; shard < READER_SHARDS; shard++)
+    {
+        flushFrees(pool, &pool->shards[shard]);
+        retireBuffer(pool, &pool->shards[shard]);
+    }
+}
+
+//------------------------------------------------------
+// checkPacing
+//
+// PURPOSE: Asks inserts, or the background collector, to start running
+// compaction steps once the old space is filling up with enough
+// garbage to be worth sliding.
+// The caller holds the allocation lock or exclusive access.
+// INPUT PARAMETERS:
+// pool - The pool being checked
+//------------------------------------------------------
+static void checkPacing(ObjectPool *pool)
+{
+    int space = pool->old.end - pool->old.start;
+
+    if ((pool->pauseBudget > 0 || pool->collectorRunning) && !pool->compacting
+        && pool->old.end - pool->old.top < space / PACING_FILL_SHARE
+        && pool->freeBytes >= space / PACING_FREE_SHARE)
+    {
+        __atomic_store_n(&pool->stepDue, 1, __ATOMIC_RELAXED);
+
+        // under the lock, so the signal cannot fall between the collector's check and its wait
+        if (pool->collectorRunning)
+        {
+            pthread_mutex_lock(&pool->collectorLock);
+            pthread_cond_signal(&pool->collectorWake);
+            pthread_mutex_unlock(&pool->collectorLock);
+        }
+    }
+}
+
+//------------------------------------------------------
+// pastDeadline
+//
+// PURPOSE: Checks the clock against the end of a compaction step.
+// INPUT PARAMETERS:
+// deadline - When the step has to end
+// OUTPUT PARAMETERS:
+// 1 if the deadline has passed, 0 otherwise.
+//------------------------------------------------------
+static int pastDeadline(const struct timespec *deadline)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return now.tv_sec > deadline->tv_sec
+        || (now.tv_sec == deadline->tv_sec && now.tv_nsec >= deadline->tv_nsec);
+}
+
+//------------------------------------------------------
+// reserveOld
+//
+// PURPOSE: Finds room for a block in the old space, in a free block
+// when one fits or at the top of the space otherwise. The bytes a free
+// block has left over around an aligned object go back on the lists.
+// The caller holds the allocation lock or exclusive access.
+// INPUT PARAMETERS:
+// pool - The pool being allocated from
+// blockSize - The size of the block including its header
+// alignment - The alignment of the object in the block
+// OUTPUT PARAMETERS:
+// Where the block starts or NO_BLOCK if the old space is full.
+//------------------------------------------------------
+static int reserveOld(ObjectPool *pool, const int blockSize, const int alignment)
+{
+    int slack = ALIGN_SLACK(alignment);
+    int offset = takeFreeBlock(pool, blockSize + slack);
+    int pad;
+
+    if (offset != NO_BLOCK && slack > 0)
+    {
+        pad = alignPad(offset, alignment);
+
+        if (pad > 0)
+        {
+            addFreeBlock(pool, offset, pad);
+        }
+
+        if (slack > pad)
+        {
+            addFreeBlock(pool, offset + pad + blockSize, slack - pad);
+        }
+
+        offset += pad;
+    }
+    else if (offset == NO_BLOCK)
+    {
+        pad = alignPad(pool->old.top, alignment);
+
+        if ((pool->old.top + pad + blockSize) <= pool->old.end)
+        {
+            if (pad > 0)
+            {
+                addFreeBlock(pool, pool->old.top, pad);
+            }
+
+            offset = pool->old.top + pad;
+            pool->old.top = offset + blockSize;
+
+            checkPacing(pool);
+        }
+    }
+
+    return offset;
+}
+
+//------------------------------------------------------
+// roundToPage
+//
+// PURPOSE: Rounds a number of bytes up to whole pages.
+// INPUT PARAMETERS:
+// bytes - The number of bytes
+// OUTPUT PARAMETERS:
+// The number of bytes in the pages that hold them.
+//------------------------------------------------------
+static size_t roundToPage(const size_t bytes)
+{
+    size_t page = (size_t) sysconf(_SC_PAGESIZE);
+
+    return (bytes + page - 1) / page * page;
+}
+
+//------------------------------------------------------
+// mapLargeObject
+//
+// PURPOSE: Maps the pages of an object in the large-object space. They
+// are page aligned and given back to the system as soon as the object
+// is freed, the buffer never sees them.
+// INPUT PARAMETERS:
+// size - The size of the object
+// OUTPUT PARAMETERS:
+// The first of the pages, or NULL if they could not be mapped.
+//------------------------------------------------------
+static unsigned char *mapLargeObject(const int size)
+{
+    void* pages = mmap(NULL, roundToPage(size > 0 ? (size_t) size : 1), PROT_READ | PROT_WRITE,
+        MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+    return pages == MAP_FAILED ? NULL_REF : (unsigned char*) pages;
+}
+
+//------------------------------------------------------
+// freeLargeObject
+//
+// PURPOSE: Unmaps the pages of a large object and releases its handle.
+// The caller has exclusive access or holds the allocation lock.
+// INPUT PARAMETERS:
+// pool - The pool that owns the object
+// index - The slot of the object
+//------------------------------------------------------
+static void freeLargeObject(ObjectPool *pool, const unsigned long index)
+{
+    Handle* handle = HANDLE_AT(pool, index);
+
+    assert(handle->large != NULL_REF);
+
+    munmap(handle->large, roundToPage(handle->ref.size > 0 ? (size_t) handle->ref.size : 1));
+
+    handle->large = NULL_REF;
+    pool->largeObjects--;
+
+    releaseHandle(pool, index);
+}
+
+//------------------------------------------------------
+// releaseTail
+//
+// PURPOSE: Gives the pages above the live data of the old space back
+// to the system once a compaction is done, keeping retainBytes of
+// them resident for the inserts that follow. The pages stay part of
+// the pool and are faulted back in, zeroed, when they are used again.
+// The caller has exclusive access.
+// INPUT PARAMETERS:
+// pool - The pool that was compacted
+// counts - Updated with the bytes given back
+//------------------------------------------------------
+static void releaseTail(ObjectPool *pool, CollectionCounts *counts)
+{
+    size_t page = pool->hugePages ? HUGE_PAGE : roundToPage(1);
+    size_t start = ((size_t) pool->old.top + (size_t) pool->retainBytes + page - 1) / page * page;
+    size_t end = roundToPage((size_t) pool->highWater);
+
+    // pages above the high water mark have not been touched since they were last given back
+    if (end > roundToPage((size_t) pool->size))
+    {
+        end = roundToPage((size_t) pool->size);
+    }
+
+    if (start < end && madvise(pool->buffer + start, end - start, MADV_DONTNEED) == 0)
+    {
+        counts->bytesReleased += (int) (end - start);
+    }
+
+    pool->highWater = pool->old.top;
+}
+
+//------------------------------------------------------
+// keepEverything
+//
+// PURPOSE: Marks every object of the pool, for when a trace could not
+// be completed. Nothing is reclaimed by the collection.
+// INPUT PARAMETERS:
+// pool - The pool being traced
+//------------------------------------------------------
+static void keepEverything(ObjectPool *pool)
+{
+    unsigned long slab;
+
+    fprintf(stdout, "Not enough memory to trace the pool, every object is kept.\n");
+
+    for (slab = 0; slab < pool->slabCount; slab++)
+    {
+        memcpy(pool->slabBits[slab]->live, pool->slabBits[slab]->used, sizeof(pool->slabBits[slab]->live));
+    }
+}
+
+//------------------------------------------------------
+// markSlot
+//
+// PURPOSE: Marks an object live for a trace run by one thread.
+// INPUT PARAMETERS:
+// pool - The pool being traced
+// index - The handle of the object
+// OUTPUT PARAMETERS:
+// Non-zero if the object was not marked yet and has to be scanned.
+//------------------------------------------------------
+static int markSlot(ObjectPool *pool, const unsigned long index)
+{
+    unsigned long* word = &pool->slabBits[index >> SLAB_BITS]->live[(index & (SLAB_HANDLES - 1)) / 64];
+    unsigned long bit = 1UL << (index % 64);
+
+    if (*word & bit)
+    {
+        return 0;
+    }
+
+    *word |= bit;
+
+    return 1;
+}
+
+//------------------------------------------------------
+// markAlone
+//
+// PURPOSE: Traces the pool on the collecting thread alone.
+// INPUT PARAMETERS:
+// pool - The pool being traced
+//------------------------------------------------------
+static void markAlone(ObjectPool *pool)
+{
+    unsigned long depth = 0;
+    unsigned long index;
+
+    // every handle is pushed at most once, so the stack never needs more room than the table
+    if (pool->markCapacity < pool->handlesUsed)
+    {
+        unsigned long* stack = (unsigned long*) realloc(pool->markStack, pool->handlesUsed * sizeof(unsigned long));
+
+        if (stack == NULL_REF)
+        {
+            keepEverything(pool);
+            return;
+        }
+
+        pool->markStack = stack;
+        pool->markCapacity = pool->handlesUsed;
+    }
+
+    for (index = nextSlot(pool, 1, USED_SLOTS); index < pool->handlesUsed; index = nextSlot(pool, index + 1, USED_SLOTS))
+    {
+        Handle* current = HANDLE_AT(pool, index);
+
+        if (current->inUse && (current->ref.count > 0 || current->pins > 0) && markSlot(pool, index))
+        {
+            if (current->slots > 0)
+            {
+                pool->markStack[depth++] = index;
+            }
+        }
+    }
+
+    while (depth > 0)
+    {
+        Handle* current;
+        Ref* slots;
+        int i;
+
+        index = pool->markStack[--depth];
+        current = HANDLE_AT(pool, index);
+        slots = (Ref*) OBJECT_AT(pool, current);
+
+        for (i = 0; i < current->slots; i++)
+        {
+            // stale references name an object that is gone and are skipped
+            Handle* target = slots[i] != NULL_REF ? findHandle(pool, slots[i]) : NULL_REF;
+
+            if (target != NULL_REF && markSlot(pool, slots[i] & REF_INDEX_MASK))
+            {
+                if (target->slots > 0)
+                {
+                    pool->markStack[depth++] = slots[i] & REF_INDEX_MASK;
+                }
+            }
+        }
+    }
+}
+
+//------------------------------------------------------
+// pushMark
+//
+// PURPOSE: Pushes a grey object on the bottom of a worker's deque,
+// doubling the deque when it is full. Only the owner pushes.
+// INPUT PARAMETERS:
+// worker - The worker that owns the deque
+// index - The handle of the object
+// OUTPUT PARAMETERS:
+// 0 if the deque was full and could not grow.
+//------------------------------------------------------
+static int pushMark(GcWorker *worker, const unsigned long index)
+{
+    long bottom = __atomic_load_n(&worker->bottom, __ATOMIC_RELAXED);
+    long top = __atomic_load_n(&worker->top, __ATOMIC_ACQUIRE);
+    MarkArray* array = __atomic_load_n(&worker->array, __ATOMIC_RELAXED);
+
+    if (array == NULL_REF || bottom - top >= array->capacity)
+    {
+        long capacity = array != NULL_REF ? array->capacity * 2 : MARK_DEQUE_SIZE;
+        MarkArray* grown = (MarkArray*) malloc(sizeof(MarkArray) + capacity * sizeof(unsigned long));
+        long i;
+
+        if (grown == NULL_REF)
+        {
+            return 0;
+        }
+
+        grown->capacity = capacity;
+        grown->retired = array;
+
+        for (i = top; i < bottom; i++)
+        {
+            grown->items[i % capacity] = __atomic_load_n(&array->items[i % array->capacity], __ATOMIC_RELAXED);
+        }
+
+        __atomic_store_n(&worker->array, grown, __ATOMIC_RELEASE);
+        array = grown;
+    }
+
+    __atomic_store_n(&array->items[bottom % array->capacity], index, __ATOMIC_RELAXED);
+    __atomic_store_n(&worker->bottom, bottom + 1, __ATOMIC_RELEASE);
+
+    return 1;
+}
+
+//------------------------------------------------------
+// takeMark
+//
+// PURPOSE: Takes the grey object at the bottom of the worker's own
+// deque, racing thieves only for the last one.
+// INPUT PARAMETERS:
+// worker - The worker that owns the deque
+// OUTPUT PARAMETERS:
+// The handle of the object or 0 if the deque is empty.
+//------------------------------------------------------
+static unsigned long takeMark(GcWorker *worker)
+{
+    long bottom = __atomic_load_n(&worker->bottom, __ATOMIC_RELAXED) - 1;
+    MarkArray* array = __atomic_load_n(&worker->array, __ATOMIC_RELAXED);
+    unsigned long index = 0;
+    long top;
+
+    __atomic_store_n(&worker->bottom, bottom, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    top = __atomic_load_n(&worker->top, __ATOMIC_RELAXED);
+
+    if (top <= bottom)
+    {
+        index = __atomic_load_n(&array->items[bottom % array->capacity], __ATOMIC_RELAXED);
+
+        if (top == bottom)
+        {
+            if (!__atomic_compare_exchange_n(&worker->top, &top, top + 1, 0, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED))
+            {
+                index = 0;
+            }
+
+            __atomic_store_n(&worker->bottom, bottom + 1, __ATOMIC_RELAXED);
+        }
+    }
+    else
+    {
+        __atomic_store_n(&worker->bottom, bottom + 1, __ATOMIC_RELAXED);
+    }
+
+    return index;
+}
+
+//------------------------------------------------------
+// stealMark
+//
+// PURPOSE: Steals the grey object at the top of another worker's deque.
+// INPUT PARAMETERS:
+// victim - The worker being stolen from
+// OUTPUT PARAMETERS:
+// The handle of the object or 0 if the deque was empty or another
+// thread got there first.
+//------------------------------------------------------
+static unsigned long stealMark(GcWorker *victim)
+{
+    long top = __atomic_load_n(&victim->top, __ATOMIC_ACQUIRE);
+    unsigned long index = 0;
+    long bottom;
+
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    bottom = __atomic_load_n(&victim->bottom, __ATOMIC_ACQUIRE);
+
+    if (top < bottom)
+    {
+        MarkArray* array = __atomic_load_n(&victim->array, __ATOMIC_ACQUIRE);
+
+        index = __atomic_load_n(&array->items[top % array->capacity], __ATOMIC_RELAXED);
+
+        if (!__atomic_compare_exchange_n(&victim->top, &top, top + 1, 0, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED))
+        {
+            index = 0;
+        }
+    }
+
+    return index;
+}
+
+//------------------------------------------------------
+// claimMark
+//
+// PURPOSE: Marks an object for the calling mark thread, unless another
+// thread marked it first.
+// INPUT PARAMETERS:
+// pool - The pool being traced
+// index - The handle of the object
+// OUTPUT PARAMETERS:
+// Non-zero if the caller marked the object and has to scan it.
+//------------------------------------------------------
+static int claimMark(ObjectPool *pool, const unsigned long index)
+{
+    unsigned long* word = &pool->slabBits[index >> SLAB_BITS]->live[(index & (SLAB_HANDLES - 1)) / 64];
+    unsigned long bit = 1UL << (index % 64);
+
+    return (__atomic_load_n(word, __ATOMIC_RELAXED) & bit) == 0
+        && (__atomic_fetch_or(word, bit, __ATOMIC_RELAXED) & bit) == 0;
+}
+
+//------------------------------------------------------
+// greyObject
+//
+// PURPOSE: Queues a newly marked object on a worker's deque if it has
+// slots to scan.
+// INPUT PARAMETERS:
+// pool - The pool being traced
+// worker - The worker that marked the object
+// index - The handle of the object
+//------------------------------------------------------
+static void greyObject(ObjectPool *pool, GcWorker *worker, const unsigned long index)
+{
+    if (HANDLE_AT(pool, index)->slots > 0 && !pushMark(worker, index))
+    {
+        __atomic_store_n(&pool->markOverflow, 1, __ATOMIC_RELAXED);
+    }
+}
+
+//------------------------------------------------------
+// scanGrey
+//
+// PURPOSE: Marks the objects a grey object's slots point to, queueing
+// those this worker marked first.
+// INPUT PARAMETERS:
+// pool - The pool being traced
+// worker - The worker scanning the object
+// index - The handle of the object
+//------------------------------------------------------
+static void scanGrey(ObjectPool *pool, GcWorker *worker, const unsigned long index)
+{
+    Handle* current = HANDLE_AT(pool, index);
+    Ref* slots = (Ref*) OBJECT_AT(pool, current);
+    int i;
+
+    for (i = 0; i < current->slots; i++)
+    {
+        Handle* target = slots[i] != NULL_REF ? findHandle(pool, slots[i]) : NULL_REF;
+
+        if (target != NULL_REF && claimMark(pool, slots[i] & REF_INDEX_MASK))
+        {
+            greyObject(pool, worker, slots[i] & REF_INDEX_MASK);
+        }
+    }
+}
+
+//------------------------------------------------------
+// markWorkLeft
+//
+// PURPOSE: Checks whether any deque of a parallel mark has objects.
+// INPUT PARAMETERS:
+// pool - The pool being traced
+// OUTPUT PARAMETERS:
+// Non-zero if some deque is not empty.
+//------------------------------------------------------
+static int markWorkLeft(ObjectPool *pool)
+{
+    int i;
+
+    for (i = 0; i < pool->gcThreads; i++)
+    {
+        GcWorker* worker = &pool->gcWorkers[i];
+
+        if (__atomic_load_n(&worker->bottom, __ATOMIC_ACQUIRE) > __atomic_load_n(&worker->top, __ATOMIC_ACQUIRE))
+        {
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+//------------------------------------------------------
+// markShare
+//
+// PURPOSE: Does one thread's share of a parallel mark. The thread marks
+// the roots in its stripe of the handle table, then scans the objects
+// on its deque, stealing from the other deques when its own runs dry.
+// A thread only goes idle with an empty deque and only threads that
+// are not idle push, so once every thread is idle the mark is done.
+// INPUT PARAMETERS:
+// pool - The pool being traced
+// id - The worker the calling thread is
+//------------------------------------------------------
+static void markShare(ObjectPool *pool, const int id)
+{
+    GcWorker* self = &pool->gcWorkers[id];
+    unsigned long handles = pool->handlesUsed - 1;
+    unsigned long first = 1 + handles * id / pool->gcThreads;
+    unsigned long last = 1 + handles * (id + 1) / pool->gcThreads;
+    unsigned long index;
+
+    for (index = nextSlot(pool, first, USED_SLOTS); index < last; index = nextSlot(pool, index + 1, USED_SLOTS))
+    {
+        Handle* current = HANDLE_AT(pool, index);
+
+        if (current->inUse && (current->ref.count > 0 || current->pins > 0) && claimMark(pool, index))
+        {
+            greyObject(pool, self, index);
+        }
+    }
+
+    while (1)
+    {
+        int victim;
+
+        while ((index = takeMark(self)) != 0)
+        {
+            scanGrey(pool, self, index);
+        }
+
+        for (victim = 1; victim < pool->gcThreads && index == 0; victim++)
+        {
+            index = stealMark(&pool->gcWorkers[(id + victim) % pool->gcThreads]);
+        }
+
+        if (index != 0)
+        {
+            scanGrey(pool, self, index);
+            continue;
+        }
+
+        __atomic_add_fetch(&pool->markIdle, 1, __ATOMIC_ACQ_REL);
+
+        while (__atomic_load_n(&pool->markIdle, __ATOMIC_ACQUIRE) < pool->gcThreads)
+        {
+            if (markWorkLeft(pool))
+            {
+                break;
+            }
+
+            sched_yield();
+        }
+
+        if (__atomic_load_n(&pool->markIdle, __ATOMIC_ACQUIRE) == pool->gcThreads)
+        {
+            return;
+        }
+
+        __atomic_sub_fetch(&pool->markIdle, 1, __ATOMIC_ACQ_REL);
+    }
+}
+
+//------------------------------------------------------
+// runHelper
+//
+// PURPOSE: The body of a GC helper thread, doing its share of every
+// task the collecting thread hands out until it is told to stop.
+// INPUT PARAMETERS:
+// arg - The worker the thread is
+//------------------------------------------------------
+static void *runHelper(void *arg)
+{
+    GcWorker* self = (GcWorker*) arg;
+    ObjectPool* pool = self->pool;
+
+    pthread_mutex_lock(&pool->helperLock);
+
+    while (1)
+    {
+        while (!pool->helperStop && pool->helperRound == self->round)
+        {
+            pthread_cond_wait(&pool->helperWake, &pool->helperLock);
+        }
+
+        if (pool->helperStop)
+        {
+            break;
+        }
+
+        self->round = pool->helperRound;
+
+        pthread_mutex_unlock(&pool->helperLock);
+
+        pool->helperTask(pool, self->id);
+
+        pthread_mutex_lock(&pool->helperLock);
+
+        if (--pool->helperPending == 0)
+        {
+            pthread_cond_signal(&pool->helperDone);
+        }
+    }
+
+    pthread_mutex_unlock(&pool->helperLock);
+
+    return NULL;
+}
+
+//------------------------------------------------------
+// runHelpers
+//
+// PURPOSE: Runs a task on the collecting thread, as worker 0, and on
+// every GC helper, returning once all of them have finished it.
+// INPUT PARAMETERS:
+// pool - The pool being collected
+// task - The task, called with the pool and the id of the worker
+//------------------------------------------------------
+static void runHelpers(ObjectPool *pool, void (*task)( ObjectPool *pool, const int id ))
+{
+    pthread_mutex_lock(&pool->helperLock);
+
+    pool->helperTask = task;
+    pool->helperPending = pool->gcThreads - 1;
+    pool->helperRound++;
+
+    pthread_cond_broadcast(&pool->helperWake);
+    pthread_mutex_unlock(&pool->helperLock);
+
+    task(pool, 0);
+
+    pthread_mutex_lock(&pool->helperLock);
+
+    while (pool->helperPending > 0)
+    {
+        pthread_cond_wait(&pool->helperDone, &pool->helperLock);
+    }
+
+    pthread_mutex_unlock(&pool->helperLock);
+}
+
+//------------------------------------------------------
+// markInParallel
+//
+// PURPOSE: Traces the pool with the collecting thread and every GC
+// helper, waiting until all of them are done.
+// INPUT PARAMETERS:
+// pool - The pool being traced
+//------------------------------------------------------
+static void markInParallel(ObjectPool *pool)
+{
+    int i;
+
+    pool->markIdle = 0;
+    pool->markOverflow = 0;
+
+    runHelpers(pool, markShare);
+
+    // nobody is reading the outgrown arrays any more
+    for (i = 0; i < pool->gcThreads; i++)
+    {
+        MarkArray* array = pool->gcWorkers[i].array;
+
+        while (array != NULL_REF && array->retired != NULL_REF)
+        {
+            MarkArray* retired = array->retired;
+
+            array->retired = retired->retired;
+            free(retired);
+        }
+    }
+
+    if (pool->markOverflow)
+    {
+        keepEverything(pool);
+    }
+}
+
+//------------------------------------------------------
+// markObjects
+//
+// PURPOSE: Traces a tracing pool from its roots, the objects that have
+// references or pins, following the reference slots of every object it
+// reaches. Cycles nothing else points to are left unmarked, whatever
+// their counts are. The live bits of the side tables are the marks.
+// The caller has exclusive access.
+// INPUT PARAMETERS:
+// pool - The pool being traced
+//------------------------------------------------------
+static void markObjects(ObjectPool *pool)
+{
+    unsigned long slab;
+
+    for (slab = 0; slab < pool->slabCount; slab++)
+    {
+        memset(pool->slabBits[slab]->live, 0, sizeof(pool->slabBits[slab]->live));
+    }
+
+    if (pool->gcThreads > 1 && pool->handlesUsed >= PARALLEL_MARK_HANDLES)
+    {
+        markInParallel(pool);
+    }
+    else
+    {
+        markAlone(pool);
+    }
+}
+
+//------------------------------------------------------
+// rememberObject
+//
+// PURPOSE: Adds an old object to the remembered set of a generational
+// tracing pool, once. When the set cannot grow the pool traces all of
+// itself on the next minor collection instead.
+// The caller holds the allocation lock or has exclusive access.
+// INPUT PARAMETERS:
+// pool - The pool that owns the object
+// index - The slot of the object
+//------------------------------------------------------
+static void rememberObject(ObjectPool *pool, const unsigned long index)
+{
+    Handle* handle = HANDLE_AT(pool, index);
+
+    if (!__atomic_load_n(&handle->remembered, __ATOMIC_RELAXED))
+    {
+        if (pool->rememberedCount == pool->rememberedCapacity)
+        {
+            unsigned long capacity = pool->rememberedCapacity == 0 ? FIRST_REMEMBERED : pool->rememberedCapacity * 2;
+            unsigned long* set = (unsigned long*) realloc(pool->rememberedSet, capacity * sizeof(unsigned long));
+
+            if (set != NULL)
+            {
+                pool->rememberedSet = set;
+                pool->rememberedCapacity = capacity;
+            }
+        }
+
+        if (pool->rememberedCount < pool->rememberedCapacity)
+        {
+            pool->rememberedSet[pool->rememberedCount++] = index;
+            __atomic_store_n(&handle->remembered, 1, __ATOMIC_RELAXED);
+        }
+        else
+        {
+            pool->rememberedOverflow = 1;
+        }
+    }
+}
+
+//------------------------------------------------------
+// noteSlotWrites
+//
+// PURPOSE: Called when a pointer to an object is handed out. Its slots
+// may be written through it until the next collection, or for as long
+// as it is pinned, so an old object of a generational tracing pool
+// is remembered in case it is made to point into the nursery.
+// The caller has entered the pool.
+// INPUT PARAMETERS:
+// pool - The pool that owns the object
+// current - The handle of the object
+// ref - The reference of the object
+//------------------------------------------------------
+static void noteSlotWrites(ObjectPool *pool, Handle *current, const Ref ref)
+{
+    if (pool->tracing && GENERATIONAL(pool) && current->slots > 0 && !IN_NURSERY(pool, current)
+        && !__atomic_load_n(&current->remembered, __ATOMIC_RELAXED))
+    {
+        lockAllocation(pool);
+        rememberObject(pool, ref & REF_INDEX_MASK);
+        unlockAllocation(pool);
+    }
+}
+
+//------------------------------------------------------
+// pointsIntoNursery
+//
+// PURPOSE: Checks whether any slot of an object names an object in the
+// nursery.
+// INPUT PARAMETERS:
+// pool - The pool that owns the object
+// current - The handle of the object
+// OUTPUT PARAMETERS:
+// Non-zero when a slot points into the nursery.
+//------------------------------------------------------
+static int pointsIntoNursery(ObjectPool *pool, Handle *current)
+{
+    Ref* slots = (Ref*) OBJECT_AT(pool, current);
+    int found = 0;
+    int i;
+
+    for (i = 0; i < current->slots && !found; i++)
+    {
+        Handle* target = slots[i] != NULL_REF ? findHandle(pool, slots[i]) : NULL_REF;
+
+        found = target != NULL_REF && IN_NURSERY(pool, target);
+    }
+
+    return found;
+}
+
+//------------------------------------------------------
+// pruneRemembered
+//
+// PURPOSE: Keeps only the old objects that still point into the nursery,
+// or that are pinned and may still be written, in the remembered set
+// after a collection. Entries of handles that were released, reused
+// or added twice are dropped. After an overflow the set is rebuilt
+// from the whole handle table. The caller has exclusive access.
+// INPUT PARAMETERS:
+// pool - The pool that was collected
+//------------------------------------------------------
+static void pruneRemembered(ObjectPool *pool)
+{
+    unsigned long kept = 0;
+    unsigned long i;
+
+    if (pool->rememberedOverflow)
+    {
+        unsigned long index;
+
+        for (i = 0; i < pool->rememberedCount; i++)
+        {
+            HANDLE_AT(pool, pool->rememberedSet[i])->remembered = 0;
+        }
+
+        pool->rememberedCount = 0;
+        pool->rememberedOverflow = 0;
+
+        for (index = nextSlot(pool, 1, USED_SLOTS); index < pool->handlesUsed; index = nextSlot(pool, index + 1, USED_SLOTS))
+        {
+            Handle* current = HANDLE_AT(pool, index);
+
+            if (current->slots > 0 && !IN_NURSERY(pool, current) && (current->pins > 0 || pointsIntoNursery(pool, current)))
+            {
+                rememberObject(pool, index);
+            }
+        }
+
+        return;
+    }
+
+    for (i = 0; i < pool->rememberedCount; i++)
+    {
+        unsigned long index = pool->rememberedSet[i];
+        Handle* current = HANDLE_AT(pool, index);
+
+        // an entry whose flag is 2 was already kept, one whose flag is 0 belongs to a released handle
+        if (current->remembered == 1 && current->inUse && current->slots > 0 && !IN_NURSERY(pool, current)
+            && (current->pins > 0 || pointsIntoNursery(pool, current)))
+        {
+            current->remembered = 2;
+            pool->rememberedSet[kept++] = index;
+        }
+        else if (current->remembered == 1)
+        {
+            current->remembered = 0;
+        }
+    }
+
+    pool->rememberedCount = kept;
+
+    for (i = 0; i < kept; i++)
+    {
+        HANDLE_AT(pool, pool->rememberedSet[i])->remembered = 1;
+    }
+}
+
+//------------------------------------------------------
+// markYoung
+//
+// PURPOSE: Marks an object of the nursery that a minor trace reached,
+// queueing it to have its slots scanned. Objects outside the nursery
+// are not traced by a minor collection.
+// INPUT PARAMETERS:
+// pool - The pool being traced
+// slot - The reference found in a slot
+// depth - The depth of the mark stack, updated
+//------------------------------------------------------
+static void markYoung(ObjectPool *pool, const Ref slot, unsigned long *depth)
+{
+    Handle* target = slot != NULL_REF ? findHandle(pool, slot) : NULL_REF;
+
+    if (target != NULL_REF && IN_NURSERY(pool, target) && markSlot(pool, slot & REF_INDEX_MASK))
+    {
+        if (target->slots > 0)
+        {
+            pool->markStack[(*depth)++] = slot & REF_INDEX_MASK;
+        }
+    }
+}
+
+//------------------------------------------------------
+// markNursery
+//
+// PURPOSE: Traces only the nursery of a generational tracing pool, from
+// the young objects that have references or pins and from the slots of
+// the remembered old objects. Old objects keep their marks, so a
+// compaction under way is not disturbed. The caller has exclusive
+// access and has prepared the collection.
+// INPUT PARAMETERS:
+// pool - The pool being traced
+//------------------------------------------------------
+static void markNursery(ObjectPool *pool)
+{
+    unsigned char* buffer = pool->buffer;
+    unsigned long depth = 0;
+    unsigned long i;
+    int keepAll = 0;
+    int scan;
+
+    if (pool->markCapacity < pool->handlesUsed)
+    {
+        unsigned long* stack = (unsigned long*) realloc(pool->markStack, pool->handlesUsed * sizeof(unsigned long));
+
+        if (stack != NULL_REF)
+        {
+            pool->markStack = stack;
+            pool->markCapacity = pool->handlesUsed;
+        }
+        else
+        {
+            fprintf(stdout, "Not enough memory to trace the nursery, every young object is kept.\n");
+            keepAll = 1;
+        }
+    }
+
+    // young objects are unmarked unless they are roots, marks of earlier traces mean nothing now
+    for (scan = pool->nursery.start; scan < pool->nursery.top; scan += BLOCK_SIZE(((BlockHeader*) &buffer[scan])->size))
+    {
+        BlockHeader* header = (BlockHeader*) &buffer[scan];
+
+        if (header->slot != 0)
+        {
+            Handle* current = HANDLE_AT(pool, header->slot);
+
+            if (keepAll || current->ref.count > 0 || current->pins > 0)
+            {
+                setSlotBit(pool->slabBits[header->slot >> SLAB_BITS]->live, header->slot, 0);
+
+                if (!keepAll && current->slots > 0)
+                {
+                    pool->markStack[depth++] = header->slot;
+                }
+            }
+            else
+            {
+                clearSlotBit(pool->slabBits[header->slot >> SLAB_BITS]->live, header->slot, 0);
+            }
+        }
+    }
+
+    for (i = 0; i < pool->rememberedCount && !keepAll; i++)
+    {
+        Handle* current = HANDLE_AT(pool, pool->rememberedSet[i]);
+
+        if (current->inUse && !IN_NURSERY(pool, current))
+        {
+            Ref* slots = (Ref*) OBJECT_AT(pool, current);
+            int slot;
+
+            for (slot = 0; slot < current->slots; slot++)
+            {
+                markYoung(pool, slots[slot], &depth);
+            }
+        }
+    }
+
+    while (depth > 0)
+    {
+        unsigned long index = pool->markStack[--depth];
+        Handle* current = HANDLE_AT(pool, index);
+        Ref* slots = (Ref*) OBJECT_AT(pool, current);
+        int slot;
+
+        for (slot = 0; slot < current->slots; slot++)
+        {
+            markYoung(pool, slots[slot], &depth);
+        }
+    }
+}
+
+//------------------------------------------------------
+// beginSlide
+//
+// PURPOSE: Starts a compaction of the old space from its bottom, tracing
+// a tracing pool first. Free blocks are slid over like any other
+// filler, so the free lists are emptied. The caller has exclusive access.
+// INPUT PARAMETERS:
+// pool - The pool being compacted
+//------------------------------------------------------
+static void beginSlide(ObjectPool *pool)
+{
+    if (pool->tracing)
+    {
+        markObjects(pool);
+    }
+
+    clearFreeLists(pool);
+
+    pool->compacting = 1;
+    pool->slideScan = pool->old.start;
+    pool->slideDest = pool->old.start;
+
+    memset(&pool->cycleCounts, 0, sizeof(CollectionCounts));
+}
+
+//------------------------------------------------------
+// slideStep
+//
+// PURPOSE: Runs the mark and compact algorithm on the old space.
+// Blocks are visited in address order and every live object is slid
+// down to the lowest free offset, so the space is compacted in place
+// without a second buffer. Pinned objects stay put and the room left
+// below them goes on the free lists. When the deadline passes first, the gap
+// between the compacted and unvisited blocks is left as filler and
+// the next step carries on from there.
+// The caller has exclusive access.
+// INPUT PARAMETERS:
+// pool - The pool being compacted
+// deadline - When the step has to end, NULL to finish the compaction
+// OUTPUT PARAMETERS:
+// 1 if the compaction is finished, 0 if blocks are left to visit.
+//------------------------------------------------------
+static int slideStep(ObjectPool *pool, const struct timespec *deadline)
+{
+    unsigned char* buffer = pool->buffer;
+    CollectionCounts* counts = &pool->cycleCounts;
+    int scan = pool->slideScan;
+    int newTop = pool->slideDest;
+    int visited = 0;
+
+    assert(pool->compacting);
+
+    while (scan < pool->old.top)
+    {
+        if (deadline != NULL && visited > 0 && (visited % DEADLINE_CHECK) == 0 && pastDeadline(deadline))
+        {
+            break;
+        }
+
+        BlockHeader* header = (BlockHeader*) &buffer[scan];
+        int blockSize = BLOCK_SIZE(header->size);
+        Handle* current = NULL_REF;
+
+        assert(header->size >= 0 && scan + blockSize <= pool->old.top);
+
+        if (header->slot != 0)
+        {
+            current = HANDLE_AT(pool, header->slot);
+
+            assert(current->inUse && current->ref.address == scan + HEADER_SIZE);
+
+            counts->bytesUsed += current->ref.size;
+        }
+        else
+        {
+            counts->bytesCollected += header->size;
+        }
+
+        if (current != NULL_REF && current->pins > 0)
+        {
+            // the object stays where it is, the room below it is only good for reuse
+            int gap = scan - newTop;
+
+            current->ref.address = scan + HEADER_SIZE;
+            newTop = scan + blockSize;
+            pool->slideDest = newTop;
+
+            if (gap > 0)
+            {
+                addFreeBlock(pool, scan - gap, gap);
+            }
+        }
+        else if (current != NULL_REF && liveSlot(pool, header->slot))
+        {
+            // the block is aligned where it is, so padding never takes the destination past it
+            int pad = alignPad(newTop, current->alignment);
+
+            if (pad > 0)
+            {
+                writeFiller(pool, newTop, pad);
+                newTop += pad;
+            }
+
+            // the destination never passes the block, so memmove handles any overlap
+            if (newTop != scan)
+            {
+                memmove(&buffer[newTop], &buffer[scan], blockSize);
+                counts->bytesMoved += blockSize;
+
+                emitEvent(pool, GC_EVENT_MOVE, NULL, current->ref.id, scan, newTop, current->ref.size, NULL);
+            }
+
+            current->ref.address = newTop + HEADER_SIZE;
+            newTop += blockSize;
+        }
+        else if (current != NULL_REF)
+        {
+            counts->bytesCollected += current->ref.size;
+
+            releaseHandle(pool, header->slot);
+        }
+
+        scan += blockSize;
+        visited++;
+    }
+
+    if (scan < pool->old.top)
+    {
+        if (scan > newTop)
+        {
+            writeFiller(pool, newTop, scan - newTop);
+        }
+
+        pool->slideScan = scan;
+        pool->slideDest = newTop;
+
+        return 0;
+    }
+
+    pool->old.top = newTop;
+    pool->compacting = 0;
+    __atomic_store_n(&pool->stepDue, 0, __ATOMIC_RELAXED);
+
+    return 1;
+}
+
+//------------------------------------------------------
+// sizeRegions
+//
+// PURPOSE: The first task of a parallel compaction. Adds up the live
+// blocks of the regions the thread claims and notes the objects only a
+// serial slide can handle.
+// INPUT PARAMETERS:
+// pool - The pool being compacted
+// id - The worker the calling thread is
+//------------------------------------------------------
+static void sizeRegions(ObjectPool *pool, const int id)
+{
+    int claimed;
+
+    (void) id;
+
+    while ((claimed = __atomic_fetch_add(&pool->nextSlideRegion, 1, __ATOMIC_RELAXED)) < pool->slideRegionCount)
+    {
+        SlideRegion* region = &pool->slideRegions[claimed];
+        int scan;
+
+        for (scan = region->first; scan < region->end; scan += BLOCK_SIZE(((BlockHeader*) &pool->buffer[scan])->size))
+        {
+            BlockHeader* header = (BlockHeader*) &pool->buffer[scan];
+
+            if (header->slot != 0)
+            {
+                Handle* current = HANDLE_AT(pool, header->slot);
+
+                if (current->pins > 0 || current->alignment > GRANULE)
+                {
+                    region->serial = 1;
+                }
+                else if (liveSlot(pool, header->slot))
+                {
+                    region->live += BLOCK_SIZE(header->size);
+                }
+            }
+        }
+    }
+}
+
+//------------------------------------------------------
+// slideRegions
+//
+// PURPOSE: The second task of a parallel compaction. Slides the live
+// objects of the regions the thread claims down to the offsets the
+// prefix sum gave them and updates their handles. Regions are claimed
+// in address order and a region only starts once every region its
+// objects slide into is done, so the lowest unfinished region can
+// always go ahead.
+// INPUT PARAMETERS:
+// pool - The pool being compacted
+// id - The worker the calling thread is
+//------------------------------------------------------
+static void slideRegions(ObjectPool *pool, const int id)
+{
+    unsigned char* buffer = pool->buffer;
+    int claimed;
+
+    (void) id;
+
+    while ((claimed = __atomic_fetch_add(&pool->nextSlideRegion, 1, __ATOMIC_RELAXED)) < pool->slideRegionCount)
+    {
+        SlideRegion* region = &pool->slideRegions[claimed];
+        CollectionCounts* counts = &region->counts;
+        int newTop = region->dest;
+        int below;
+        int scan;
+
+        for (below = region->below; below < claimed; below++)
+        {
+            while (!__atomic_load_n(&pool->slideRegions[below].done, __ATOMIC_ACQUIRE))
+            {
+                sched_yield();
+            }
+        }
+
+        for (scan = region->first; scan < region->end; )
+        {
+            BlockHeader* header = (BlockHeader*) &buffer[scan];
+            int blockSize = BLOCK_SIZE(header->size);
+
+            if (header->slot == 0)
+            {
+                counts->bytesCollected += header->size;
+            }
+            else
+            {
+                unsigned long index = header->slot;
+                Handle* current = HANDLE_AT(pool, index);
+
+                counts->bytesUsed += current->ref.size;
+
+                if (liveSlot(pool, index))
+                {
+                    if (newTop != scan)
+                    {
+                        memmove(&buffer[newTop], &buffer[scan], blockSize);
+                        counts->bytesMoved += blockSize;
+                        emitEvent(pool, GC_EVENT_MOVE, NULL, current->ref.id, scan, newTop, current->ref.size, NULL);
+                    }
+
+                    current->ref.address = newTop + HEADER_SIZE;
+                    newTop += blockSize;
+                }
+                else
+                {
+                    // released like releaseHandle does, onto a list of the region's own
+                    counts->bytesCollected += current->ref.size;
+
+                    current->inUse = 0;
+                    current->generation++;
+                    __atomic_store_n(&current->ref.id, NULL_REF, __ATOMIC_RELAXED);
+                    clearSlotBits(pool, index, 1);
+                    current->nextFree = region->releasedFirst;
+                    region->releasedFirst = index;
+
+                    if (region->releasedLast == 0)
+                    {
+                        region->releasedLast = index;
+                    }
+                }
+            }
+
+            scan += blockSize;
+        }
+
+        __atomic_store_n(&region->done, 1, __ATOMIC_RELEASE);
+    }
+}
+
+//------------------------------------------------------
+// slideInParallel
+//
+// PURPOSE: Slides the whole old space with every GC thread, for a
+// compaction that has just begun. Pools with one thread, a small old
+// space, pinned objects or aligned ones are left to slideStep, which
+// works around pins and pads aligned objects.
+// The caller has exclusive access.
+// INPUT PARAMETERS:
+// pool - The pool being compacted
+// OUTPUT PARAMETERS:
+// 1 if the old space was compacted, 0 if it is left to slideStep.
+//------------------------------------------------------
+static int slideInParallel(ObjectPool *pool)
+{
+    int span = pool->old.top - pool->old.start;
+    int count = (span + SLIDE_REGION_BYTES - 1) / SLIDE_REGION_BYTES;
+    SlideRegion* regions;
+    int region = 0;
+    int newTop = pool->old.start;
+    int scan;
+    int i;
+
+    if (pool->gcThreads < 2 || span < PARALLEL_SLIDE_BYTES)
+    {
+        return 0;
+    }
+
+    regions = (SlideRegion*) calloc(count, sizeof(SlideRegion));
+
+    if (regions == NULL_REF)
+    {
+        return 0;
+    }
+
+    // only the headers tell where blocks start, so one thread hops over them to find the
+    // first block of each region
+    for (scan = pool->old.start; scan < pool->old.top; scan += BLOCK_SIZE(((BlockHeader*) &pool->buffer[scan])->size))
+    {
+        while (region < count && scan >= pool->old.start + region * SLIDE_REGION_BYTES)
+        {
+            regions[region++].first = scan;
+        }
+    }
+
+    while (region < count)
+    {
+        regions[region++].first = pool->old.top;
+    }
+
+    for (i = 0; i < count; i++)
+    {
+        regions[i].end = i + 1 < count ? regions[i + 1].first : pool->old.top;
+    }
+
+    pool->slideRegions = regions;
+    pool->slideRegionCount = count;
+    pool->nextSlideRegion = 0;
+
+    runHelpers(pool, sizeRegions);
+
+    for (i = 0; i < count; i++)
+    {
+        if (regions[i].serial)
+        {
+            pool->slideRegions = NULL_REF;
+            free(regions);
+
+            return 0;
+        }
+
+        regions[i].dest = newTop;
+        newTop += regions[i].live;
+    }
+
+    // a big block can span several regions, so what dest lands on is found by block rather than by address
+    for (i = 0, region = 0; i < count; i++)
+    {
+        while (region + 1 < i && regions[region + 1].first <= regions[i].dest)
+        {
+            region++;
+        }
+
+        regions[i].below = region;
+    }
+
+    pool->nextSlideRegion = 0;
+
+    runHelpers(pool, slideRegions);
+
+    for (i = 0; i < count; i++)
+    {
+        pool->cycleCounts.bytesUsed += regions[i].counts.bytesUsed;
+        pool->cycleCounts.bytesCollected += regions[i].counts.bytesCollected;
+        pool->cycleCounts.bytesMoved += regions[i].counts.bytesMoved;
+
+        if (regions[i].releasedFirst != 0)
+        {
+            HANDLE_AT(pool, regions[i].releasedLast)->nextFree = pool->freeHandle;
+            pool->freeHandle = regions[i].releasedFirst;
+        }
+    }
+
+    pool->slideRegions = NULL_REF;
+    free(regions);
+
+    pool->old.top = newTop;
+    pool->compacting = 0;
+    __atomic_store_n(&pool->stepDue, 0, __ATOMIC_RELAXED);
+
+    return 1;
+}
+
+//------------------------------------------------------
+// collectNursery
+//
+// PURPOSE: Walks the nursery, promoting survivors that are old enough
+// into the old space and sliding the rest down. Objects that cannot
+// be promoted because the old space is full stay in the nursery, and
+// pinned objects stay exactly where they are.
+// The caller has exclusive access.
+// INPUT PARAMETERS:
+// pool - The pool being collected
+// counts - Updated with what the collection did
+//------------------------------------------------------
+static void collectNursery(ObjectPool *pool, CollectionCounts *counts)
+{
+    unsigned char* buffer = pool->buffer;
+    int scan = pool->nursery.start;
+    int newTop = pool->nursery.start;
+
+    while (scan < pool->nursery.top)
+    {
+        BlockHeader* header = (BlockHeader*) &buffer[scan];
+        int blockSize = BLOCK_SIZE(header->size);
+        Handle* current = NULL_REF;
+
+        assert(header->size >= 0 && scan + blockSize <= pool->nursery.top);
+
+        if (header->slot != 0)
+        {
+            current = HANDLE_AT(pool, header->slot);
+
+            assert(current->inUse && current->ref.address == scan + HEADER_SIZE);
+
+            counts->bytesUsed += current->ref.size;
+        }
+        else
+        {
+            counts->bytesCollected += header->size;
+        }
+
+        if (current != NULL_REF && current->pins > 0)
+        {
+            // the object stays where it is, the room below it waits for the next collection
+            if (newTop != scan)
+            {
+                writeFiller(pool, newTop, scan - newTop);
+            }
+
+            newTop = scan + blockSize;
+        }
+        else if (current != NULL_REF && liveSlot(pool, header->slot))
+        {
+            int target = NO_BLOCK;
+
+            if (++current->age >= pool->promotionAge)
+            {
+                target = reserveOld(pool, blockSize, current->alignment);
+            }
+
+            if (target != NO_BLOCK)
+            {
+                memcpy(&buffer[target], &buffer[scan], blockSize);
+                counts->bytesMoved += blockSize;
+
+                emitEvent(pool, GC_EVENT_MOVE, NULL, current->ref.id, scan, target, current->ref.size, NULL);
+
+                current->ref.address = target + HEADER_SIZE;
+
+                // its slots may still point into the nursery
+                if (pool->tracing && current->slots > 0)
+                {
+                    rememberObject(pool, header->slot);
+                }
+            }
+            else
+            {
+                int pad = alignPad(newTop, current->alignment);
+
+                if (pad > 0)
+                {
+                    writeFiller(pool, newTop, pad);
+                    newTop += pad;
+                }
+
+                if (newTop != scan)
+                {
+                    memmove(&buffer[newTop], &buffer[scan], blockSize);
+                    counts->bytesMoved += blockSize;
+
+                    emitEvent(pool, GC_EVENT_MOVE, NULL, current->ref.id, scan, newTop, current->ref.size, NULL);
+                }
+
+                current->ref.address = newTop + HEADER_SIZE;
+                newTop += blockSize;
+            }
+        }
+        else if (current != NULL_REF)
+        {
+            counts->bytesCollected += current->ref.size;
+
+            releaseHandle(pool, header->slot);
+        }
+
+        scan += blockSize;
+    }
+
+    pool->nursery.top = newTop;
+}
+
+//------------------------------------------------------
+// beginPause
+//
+// PURPOSE: Notes when a collection starts holding the pool.
+// INPUT PARAMETERS:
+// pool - The pool being paused
+// kind - The kind of collection
+// OUTPUT PARAMETERS:
+// started - When the pause started
+//------------------------------------------------------
+static void beginPause(ObjectPool *pool, const char *kind, struct timespec *started)
+{
+    clock_gettime(CLOCK_MONOTONIC, started);
+
+    emitEvent(pool, GC_EVENT_BEGIN, kind, NULL_REF, 0, 0, 0, started);
+}
+
+//------------------------------------------------------
+// finishCollection
+//
+// PURPOSE: Counts a finished collection in the pool stats, and prints
+// what it did when the pool is verbose.
+// The caller has exclusive access.
+// INPUT PARAMETERS:
+// pool - The pool that was collected
+// title - The kind of collection
+// counts - What the collection did
+//------------------------------------------------------
+static void finishCollection(ObjectPool *pool, const char *title, const CollectionCounts *counts)
+{
+    PoolStats* stats = &pool->stats;
+
+    pool->collections++;
+
+    stats->bytesMoved += counts->bytesMoved;
+    stats->bytesReclaimed += counts->bytesCollected;
+    stats->bytesReleased += counts->bytesReleased;
+    stats->lastBytesMoved = counts->bytesMoved;
+    stats->lastBytesReclaimed = counts->bytesCollected;
+
+    if (pool->verbose)
+    {
+        fprintf(stdout, "\n%s STATS\n", title);
+        fprintf(stdout, "-----------------------\n");
+        fprintf(stdout, "Total objects: %lu\n", countObjects(pool));
+        fprintf(stdout, "Total number of bytes used: %d\n", counts->bytesUsed);
+        fprintf(stdout, "Total number of bytes collected: %d\n", counts->bytesCollected);
+        fprintf(stdout, "Total number of bytes moved: %d\n", counts->bytesMoved);
+        fprintf(stdout, "Total number of bytes returned to the system: %d\n", counts->bytesReleased);
+        fprintf(stdout, "-----------------------\n");
+    }
+}
+
+//------------------------------------------------------
+// recordPause
+//
+// PURPOSE: Adds the time a collection held the pool to the pause
+// stats. The caller has exclusive access.
+// INPUT PARAMETERS:
+// pool - The pool that was paused
+// kind - The kind of collection
+// started - When the pause started
+//------------------------------------------------------
+static void recordPause(ObjectPool *pool, const char *kind, const struct timespec *started)
+{
+    PoolStats* stats = &pool->stats;
+    struct timespec now;
+    unsigned long nanos;
+    unsigned long micros;
+    int bucket = 0;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    nanos = (unsigned long) ((now.tv_sec - started->tv_sec) * 1000000000L + (now.tv_nsec - started->tv_nsec));
+
+    // bucket i holds pauses under 2^i microseconds
+    for (micros = nanos / 1000; micros > 0 && bucket < PAUSE_BUCKETS - 1; micros >>= 1)
+    {
+        bucket++;
+    }
+
+    stats->pauseHistogram[bucket]++;
+    stats->totalPauseNanos += nanos;
+    stats->lastPauseNanos = nanos;
+
+    if (nanos > stats->maxPauseNanos)
+    {
+        stats->maxPauseNanos = nanos;
+    }
+
+    emitEvent(pool, GC_EVENT_END, kind, NULL_REF, 0, 0, 0, &now);
+}
+
+//------------------------------------------------------
+// sweepLargeObjects
+//
+// PURPOSE: Frees the large objects the collection found dead. They
+// are never moved, so freeing their pages is all the collector does.
+// The side tables alone tell which are dead, so live ones are never
+// read. Dead ones that are still pinned wait for a later collection.
+// The caller has exclusive access.
+// INPUT PARAMETERS:
+// pool - The pool being collected
+// counts - The counts of the collection, the bytes reclaimed are added
+//------------------------------------------------------
+static void sweepLargeObjects(ObjectPool *pool, CollectionCounts *counts)
+{
+    unsigned long index;
+
+    for (index = nextSlot(pool, 1, DEAD_LARGE_SLOTS); index < pool->handlesUsed; index = nextSlot(pool, index + 1, DEAD_LARGE_SLOTS))
+    {
+        Handle* current = HANDLE_AT(pool, index);
+
+        if (current->pins == 0)
+        {
+            counts->bytesCollected += current->ref.size;
+
+            freeLargeObject(pool, index);
+        }
+    }
+}
+
+//------------------------------------------------------
+// groupHotObjects
+//
+// PURPOSE: Moves the hot objects of a freshly compacted old space to its
+// top, next to each other and in the order they were allocated, and
+// slides the rest down in their order. Objects used together so share
+// cache lines and pages instead of being spread among cold ones. The
+// hot objects are staged in the free room above the old space, so the
+// pool needs no memory besides its own. The access counts are halved
+// either way, so hotness follows recent use. Old spaces with pinned or
+// aligned objects are left as they are, as are those without room to
+// stage the hot objects or without cold ones to move them past.
+// The caller has exclusive access.
+// INPUT PARAMETERS:
+// pool - The pool being compacted
+// counts - The counts of the collection, the bytes moved are added
+//------------------------------------------------------
+static void groupHotObjects(ObjectPool *pool, CollectionCounts *counts)
+{
+    unsigned char* buffer = pool->buffer;
+    int stage = pool->old.top;
+    int hotBytes = 0;
+    int coldBytes = 0;
+    int movable = 1;
+    int newTop = pool->old.start;
+    int scan;
+
+    for (scan = pool->old.start; scan < pool->old.top; scan += BLOCK_SIZE(((BlockHeader*) &buffer[scan])->size))
+    {
+        BlockHeader* header = (BlockHeader*) &buffer[scan];
+
+        // only a compaction around pins leaves free blocks behind, and moving aligned objects
+        // about could take more room than they had
+        if (header->slot == 0 || HANDLE_AT(pool, header->slot)->pins > 0 || HANDLE_AT(pool, header->slot)->alignment > GRANULE)
+        {
+            movable = 0;
+        }
+        else if (HANDLE_AT(pool, header->slot)->accesses >= HOT_ACCESSES)
+        {
+            hotBytes += BLOCK_SIZE(header->size);
+        }
+        else
+        {
+            coldBytes += BLOCK_SIZE(header->size);
+        }
+    }
+
+    if (!movable || hotBytes == 0 || coldBytes == 0 || pool->old.end - pool->old.top < hotBytes)
+    {
+        for (scan = pool->old.start; scan < pool->old.top; scan += BLOCK_SIZE(((BlockHeader*) &buffer[scan])->size))
+        {
+            BlockHeader* header = (BlockHeader*) &buffer[scan];
+
+            if (header->slot != 0)
+            {
+                HANDLE_AT(pool, header->slot)->accesses /= 2;
+            }
+        }
+
+        return;
+    }
+
+    // the staged pages are given back with the rest of the tail
+    if (pool->old.top + hotBytes > pool->highWater)
+    {
+        pool->highWater = pool->old.top + hotBytes;
+    }
+
+    for (scan = pool->old.start; scan < pool->old.top; )
+    {
+        BlockHeader* header = (BlockHeader*) &buffer[scan];
+        Handle* current = HANDLE_AT(pool, header->slot);
+        int blockSize = BLOCK_SIZE(header->size);
+
+        if (current->accesses >= HOT_ACCESSES)
+        {
+            // the handle keeps the old address until the object is moved back down
+            memcpy(&buffer[stage], &buffer[scan], blockSize);
+            stage += blockSize;
+        }
+        else
+        {
+            if (newTop != scan)
+            {
+                memmove(&buffer[newTop], &buffer[scan], blockSize);
+                counts->bytesMoved += blockSize;
+
+                emitEvent(pool, GC_EVENT_MOVE, NULL, current->ref.id, scan, newTop, current->ref.size, NULL);
+            }
+
+            current->ref.address = newTop + HEADER_SIZE;
+            newTop += blockSize;
+        }
+
+        current->accesses /= 2;
+        scan += blockSize;
+    }
+
+    assert(newTop + hotBytes == pool->old.top && stage == pool->old.top + hotBytes);
+
+    memmove(&buffer[newTop], &buffer[pool->old.top], hotBytes);
+
+    for (scan = newTop; scan < pool->old.top; scan += BLOCK_SIZE(((BlockHeader*) &buffer[scan])->size))
+    {
+        Handle* current = HANDLE_AT(pool, ((BlockHeader*) &buffer[scan])->slot);
+
+        if (current->ref.address != scan + HEADER_SIZE)
+        {
+            counts->bytesMoved += BLOCK_SIZE(current->ref.size);
+
+            emitEvent(pool, GC_EVENT_MOVE, NULL, current->ref.id, current->ref.address - HEADER_SIZE, scan,
+                current->ref.size, NULL);
+        }
+
+        current->ref.address = scan + HEADER_SIZE;
+    }
+}
+
+//------------------------------------------------------
+// compact
+//
+// PURPOSE: Runs a full collection, compacting all of the old space in
+// place and then collecting the nursery of a generational pool into the
+// room that freed up. The caller has exclusive access.
+// INPUT PARAMETERS:
+// pool - The pool being compacted
+//------------------------------------------------------
+static void compact(ObjectPool *pool)
+{
+    struct timespec started;
+
+    beginPause(pool, "GARBAGE COLLECTION", &started);
+
+    prepareCollection(pool);
+
+    // a compaction under way is started over, the part it did is walked without moving
+    beginSlide(pool);
+
+    if (!slideInParallel(pool))
+    {
+        slideStep(pool, NULL);
+    }
+
+    if (pool->hotGrouping)
+    {
+        groupHotObjects(pool, &pool->cycleCounts);
+    }
+
+    sweepLargeObjects(pool, &pool->cycleCounts);
+
+    if (GENERATIONAL(pool))
+    {
+        collectNursery(pool, &pool->cycleCounts);
+
+        if (pool->tracing)
+        {
+            pruneRemembered(pool);
+        }
+    }
+
+    releaseTail(pool, &pool->cycleCounts);
+
+    verifyState(pool);
+
+    finishCollection(pool, "GARBAGE COLLECTION", &pool->cycleCounts);
+    recordPause(pool, "GARBAGE COLLECTION", &started);
+}
+
+//------------------------------------------------------
+// minorCollection
+//
+// PURPOSE: Collects only the nursery of a generational pool, leaving
+// the old space where it is. The caller has exclusive access.
+// INPUT PARAMETERS:
+// pool - The pool being collected
+//------------------------------------------------------
+static void minorCollection(ObjectPool *pool)
+{
+    CollectionCounts counts = { 0, 0, 0, 0 };
+    struct timespec started;
+
+    beginPause(pool, "MINOR COLLECTION", &started);
+
+    prepareCollection(pool);
+
+    // old objects are not traced, those that may point into the nursery are remembered
+    if (pool->tracing && pool->rememberedOverflow)
+    {
+        markObjects(pool);
+    }
+    else if (pool->tracing)
+    {
+        markNursery(pool);
+    }
+
+    collectNursery(pool, &counts);
+
+    if (pool->tracing)
+    {
+        pruneRemembered(pool);
+    }
+
+    pool->stats.minorCollections++;
+
+    finishCollection(pool, "MINOR COLLECTION", &counts);
+    recordPause(pool, "MINOR COLLECTION", &started);
+}
+
+//------------------------------------------------------
+// initHandle
+//
+// PURPOSE: Fills in the handle of a new object with one reference.
+// The caller holds the allocation lock or a shard's handle batch.
+// INPUT PARAMETERS:
+// pool - The pool the object is inserted into
+// index - The slot of the handle
+// address - Where the object starts in the buffer, 0 for a large object
+// large - The pages of a large object, NULL for one in the buffer
+// size - The size of the object
+// alignment - The alignment of the object
+// OUTPUT PARAMETERS:
+// The reference of the new object.
+//------------------------------------------------------
+static Ref initHandle(ObjectPool *pool, const unsigned long index, const int address, unsigned char *large,
+    const int size, const int alignment)
+{
+    Handle* handle = HANDLE_AT(pool, index);
+
+    handle->ref = createReference(size, address, NULL_REF, 1);
+    handle->inUse = 1;
+    handle->nextFree = 0;
+    handle->age = 0;
+    handle->pins = 0;
+    handle->slots = 0;
+    handle->remembered = 0;
+    handle->accesses = 0;
+    handle->large = large;
+    handle->alignment = alignment;
+
+    setSlotBits(pool, index, large != NULL_REF);
+
+    // publish the id last so lock-free lookups never see a half built entry
+    __atomic_store_n(&handle->ref.id, makeRef(index, handle->generation), __ATOMIC_RELEASE);
+
+    return handle->ref.id;
+}
+
+//------------------------------------------------------
+// placeObject
+//
+// PURPOSE: Writes the header and handle of a new object into space
+// that has already been reserved for it.
+// INPUT PARAMETERS:
+// pool - The pool the object is inserted into
+// index - The handle reserved for the object
+// offset - Where the object's block starts
+// size - The size of the object
+// alignment - The alignment of the object, which the block already has
+// OUTPUT PARAMETERS:
+// The reference of the new object.
+//------------------------------------------------------
+static Ref placeObject(ObjectPool *pool, const unsigned long index, const int offset, const int size, const int alignment)
+{
+    BlockHeader* header = (BlockHeader*) &pool->buffer[offset];
+
+    assert(((offset + HEADER_SIZE) & (alignment - 1)) == 0);
+
+    header->size = size;
+    header->slot = (unsigned int) index;
+
+    return initHandle(pool, index, offset + HEADER_SIZE, NULL_REF, size, alignment);
+}
+
+//------------------------------------------------------
+// refillShard
+//
+// PURPOSE: Gives a shard a new chunk of the pool when the block does
+// not fit in its current one, and a new batch of handles when it has
+// run out. The caller holds the shard lock.
+// INPUT PARAMETERS:
+// pool - The pool the chunk comes from
+// shard - The shard being refilled
+// blockSize - The size of the block that has to fit
+// OUTPUT PARAMETERS:
+// Non-zero when the shard can now hold the block.
+//------------------------------------------------------
+static int refillShard(ObjectPool *pool, ReaderShard *shard, const int blockSize)
+{
+    // chunks come from wherever new objects go
+    Space* space = GENERATIONAL(pool) ? &pool->nursery : &pool->old;
+
+    lockAllocation(pool);
+
+    flushFrees(pool, shard);
+
+    if ((shard->tlabTop + blockSize) > shard->tlabEnd)
+    {
+        int chunk = space->end - space->top;
+
+        if (chunk > pool->tlabSize)
+        {
+            chunk = pool->tlabSize;
+        }
+
+        if (chunk >= blockSize)
+        {
+            retireBuffer(pool, shard);
+
+            shard->tlabTop = space->top;
+            shard->tlabEnd = space->top + chunk;
+            space->top += chunk;
+
+            checkPacing(pool);
+        }
+    }
+
+    if (shard->handleCache == 0)
+    {
+        int i;
+
+        for (i = 0; i < HANDLE_BATCH; i++)
+        {
+            unsigned long index = allocateHandle(pool);
+
+            if (index == 0)
+            {
+                break;
+            }
+
+            HANDLE_AT(pool, index)->nextFree = shard->handleCache;
+            shard->handleCache = index;
+        }
+    }
+
+    unlockAllocation(pool);
+
+    return (shard->tlabTop + blockSize) <= shard->tlabEnd && shard->handleCache != 0;
+}
+
+//------------------------------------------------------
+// fitsPool
+//
+// PURPOSE: Tells whether an object could ever be inserted into a pool,
+// with its header, rounding and alignment padding, once it has grown
+// as far as it may and holds nothing else. Large objects always fit.
+// INPUT PARAMETERS:
+// pool - The pool the object would go into
+// size - The size of the object
+// alignment - The alignment of the object
+// OUTPUT PARAMETERS:
+// Non-zero when the object can fit.
+//------------------------------------------------------
+static int fitsPool(ObjectPool *pool, const int size, const int alignment)
+{
+    return size >= 0 && (IS_LARGE(pool, size)
+        || HEADER_SIZE + ALIGN_UP((long) size) + ALIGN_SLACK(alignment) <= (long) pool->reserved - pool->old.start);
+}
+
+//------------------------------------------------------
+// spaceFor
+//
+// PURPOSE: Picks the space a new object goes into, the nursery of a
+// generational pool unless the object is too big for it.
+// INPUT PARAMETERS:
+// pool - The pool the object is inserted into
+// blockSize - The size of the block including its header
+// OUTPUT PARAMETERS:
+// The space for the object.
+//------------------------------------------------------
+static Space *spaceFor(ObjectPool *pool, const int blockSize)
+{
+    Space* space = &pool->old;
+
+    if (GENERATIONAL(pool) && blockSize <= (pool->nursery.end - pool->nursery.start) / NURSERY_FRACTION)
+    {
+        space = &pool->nursery;
+    }
+
+    return space;
+}
+
+//------------------------------------------------------
+// allocateLocked
+//
+// PURPOSE: Allocates a block and a handle for a new object from the
+// shared part of a space, reusing a free block when the space is
+// the old space. The caller holds the allocation lock.
+// INPUT PARAMETERS:
+// pool - The pool the object is inserted into
+// space - The space the object goes into
+// size - The size of the object
+// alignment - The alignment of the object
+// OUTPUT PARAMETERS:
+// Either the reference of the new object or NULL_REF if there is
+// no room left for it.
+//------------------------------------------------------
+static Ref allocateLocked(ObjectPool *pool, Space *space, const int size, const int alignment)
+{
+    Ref id = NULL_REF;
+    int blockSize = BLOCK_SIZE(size);
+    unsigned long index = allocateHandle(pool);
+
+    if (index != 0)
+    {
+        int offset = NO_BLOCK;
+        unsigned char* large = NULL_REF;
+
+        if (IS_LARGE(pool, size))
+        {
+            large = mapLargeObject(size);
+        }
+        else if (space == &pool->old)
+        {
+            offset = reserveOld(pool, blockSize, alignment);
+        }
+        else if ((space->top + alignPad(space->top, alignment) + blockSize) <= space->end)
+        {
+            int pad = alignPad(space->top, alignment);
+
+            if (pad > 0)
+            {
+                writeFiller(pool, space->top, pad);
+            }
+
+            offset = space->top + pad;
+            space->top = offset + blockSize;
+        }
+
+        if (large != NULL_REF)
+        {
+            id = initHandle(pool, index, 0, large, size, alignment);
+
+            pool->largeObjects++;
+            pool->totalObjects++;
+        }
+        else if (offset != NO_BLOCK)
+        {
+            id = placeObject(pool, index, offset, size, alignment);
+
+            pool->totalObjects++;
+        }
+        else
+        {
+            // give the handle back, nothing can be placed in it
+            HANDLE_AT(pool, index)->nextFree = pool->freeHandle;
+            pool->freeHandle = index;
+        }
+    }
+
+    return id;
+}
+
+//------------------------------------------------------
+// allocateObject
+//
+// PURPOSE: Allocates a block and a handle for a new object. Small
+// objects in a shared pool come from the calling thread's chunk,
+// objects in a generational pool go into the nursery unless they
+// are too big for it. The caller has entered the pool.
+// INPUT PARAMETERS:
+// pool - The pool the object is inserted into
+// size - The size of the object
+// alignment - The alignment of the object
+// OUTPUT PARAMETERS:
+// Either the reference of the new object or NULL_REF if there is
+// no room left for it.
+//------------------------------------------------------
+static Ref allocateObject(ObjectPool *pool, const int size, const int alignment)
+{
+    Ref id = NULL_REF;
+    int blockSize = BLOCK_SIZE(size);
+    Space* space = spaceFor(pool, blockSize + ALIGN_SLACK(alignment));
+
+    if (pool->concurrent && blockSize + ALIGN_SLACK(alignment) <= pool->tlabSize / TLAB_FRACTION && !IS_LARGE(pool, size)
+        && (space == &pool->nursery || !GENERATIONAL(pool)))
+    {
+        ReaderShard* shard = &pool->shards[threadShard];
+
+        lockShard(shard);
+
+        if (((shard->tlabTop + alignPad(shard->tlabTop, alignment) + blockSize) <= shard->tlabEnd && shard->handleCache != 0)
+            || refillShard(pool, shard, blockSize + ALIGN_SLACK(alignment)))
+        {
+            unsigned long index = shard->handleCache;
+            int pad = alignPad(shard->tlabTop, alignment);
+
+            shard->handleCache = HANDLE_AT(pool, index)->nextFree;
+
+            if (pad > 0)
+            {
+                writeFiller(pool, shard->tlabTop, pad);
+                shard->tlabTop += pad;
+            }
+
+            id = placeObject(pool, index, shard->tlabTop, size, alignment);
+
+            shard->tlabTop += blockSize;
+            __atomic_store_n(&shard->objects, shard->objects + 1, __ATOMIC_RELAXED);
+        }
+
+        unlockShard(shard);
+    }
+
+    if (id == NULL_REF)
+    {
+        lockAllocation(pool);
+        id = allocateLocked(pool, space, size, alignment);
+        unlockAllocation(pool);
+    }
+
+    return id;
+}
+
+//------------------------------------------------------
+// allocateBatch
+//
+// PURPOSE: Allocates every object of a batch that does not have a
+// reference yet, taking the allocation lock once for all of them.
+// Sizes that can never fit are skipped. The caller has entered the
+// pool or has exclusive access.
+// INPUT PARAMETERS:
+// pool - The pool the objects are inserted into
+// sizes - The sizes of the objects
+// out - The references of the objects, NULL_REF where still missing
+// n - The number of objects in the batch
+// alignment - The alignment of every object in the batch
+// pretenure - Non-zero to put every object into the old space
+// OUTPUT PARAMETERS:
+// The number of objects still missing a reference.
+//------------------------------------------------------
+static int allocateBatch(ObjectPool *pool, const int *sizes, Ref *out, const int n, const int alignment, const int pretenure)
+{
+    int missing = 0;
+    int i;
+
+    lockAllocation(pool);
+
+    for (i = 0; i < n; i++)
+    {
+        if (out[i] == NULL_REF && fitsPool(pool, sizes[i], alignment))
+        {
+            Space* space = pretenure ? &pool->old : spaceFor(pool, BLOCK_SIZE(sizes[i]) + ALIGN_SLACK(alignment));
+
+            out[i] = allocateLocked(pool, space, sizes[i], alignment);
+
+            if (out[i] == NULL_REF)
+            {
+                missing++;
+            }
+        }
+    }
+
+    unlockAllocation(pool);
+
+    return missing;
+}
+
+//------------------------------------------------------
+// freeObject
+//
+// PURPOSE: Reclaims an object as soon as its count drops to zero,
+// making its block available to the next insert that fits, or giving
+// back the pages of a large object.
+// The caller has entered the pool.
+// INPUT PARAMETERS:
+// pool - The pool that owns the object
+// index - The handle of the object
+//------------------------------------------------------
+static void freeObject(ObjectPool *pool, const unsigned long index)
+{
+    if (HANDLE_AT(pool, index)->large != NULL_REF)
+    {
+        // the pages go back now, there is nothing in the buffer to queue
+        if (pool->concurrent)
+        {
+            lockAllocation(pool);
+            freeLargeObject(pool, index);
+            unlockAllocation(pool);
+        }
+        else
+        {
+            freeLargeObject(pool, index);
+        }
+    }
+    else if (pool->concurrent)
+    {
+        ReaderShard* shard = &pool->shards[threadShard];
+
+        lockShard(shard);
+
+        shard->pendingFrees[shard->pendingCount++] = (unsigned int) index;
+
+        if (shard->pendingCount == PENDING_FREES)
+        {
+            lockAllocation(pool);
+            flushFrees(pool, shard);
+            unlockAllocation(pool);
+        }
+
+        unlockShard(shard);
+    }
+    else
+    {
+        Handle* handle = HANDLE_AT(pool, index);
+
+        addFreeBlock(pool, handle->ref.address - HEADER_SIZE, BLOCK_SIZE(handle->ref.size));
+
+        releaseHandle(pool, index);
+    }
+}
+
+//------------------------------------------------------
+// noteCount
+//
+// PURPOSE: Sets the live bit of an object whose count has just gone
+// from zero or to zero. Another thread may take the count across zero
+// the other way in between, so in a concurrent pool whoever writes the
+// bit checks the count again afterwards and puts it right; the last
+// thread to write it so leaves it matching the count.
+// INPUT PARAMETERS:
+// pool - The pool that owns the object
+// index - The handle of the object
+// live - Non-zero when the count went from zero
+//------------------------------------------------------
+static void noteCount(ObjectPool *pool, const unsigned long index, int live)
+{
+    SlabBits* bits = pool->slabBits[index >> SLAB_BITS];
+
+    do
+    {
+        if (live)
+        {
+            setSlotBit(bits->live, index, pool->concurrent);
+        }
+        else
+        {
+            clearSlotBit(bits->live, index, pool->concurrent);
+        }
+
+        live = !live;
+    }
+    while (pool->concurrent && (__atomic_load_n(&HANDLE_AT(pool, index)->ref.count, __ATOMIC_SEQ_CST) > 0) == live);
+}
+
+//------------------------------------------------------
+// changeCount
+//
+// PURPOSE: Adds to or takes from the count of an object, freeing it
+// when its last reference is dropped. The caller has entered the pool.
+// INPUT PARAMETERS:
+// pool - The pool that owns the object
+// ref - The reference of the object
+// delta - 1 to add a reference, -1 to drop one
+//------------------------------------------------------
+static void changeCount(ObjectPool *pool, const Ref ref, const int delta)
+{
+    Handle* current = ref > 0 ? findHandle(pool, ref) : NULL_REF;
+
+    assert(current != NULL_REF);
+
+    if (current != NULL_REF)
+    {
+        int count;
+
+        if (pool->concurrent)
+        {
+            count = __atomic_add_fetch(&current->ref.count, delta, __ATOMIC_SEQ_CST);
+        }
+        else
+        {
+            count = current->ref.count += delta;
+        }
+
+        // a pool collecting by counts keeps the objects with references, and tracing pools keep what the trace marks
+        if (!pool->tracing && (count == 0 || (delta > 0 && count == delta)))
+        {
+            noteCount(pool, ref & REF_INDEX_MASK, count > 0);
+        }
+
+        // nobody can reach the object any more, so its space can be reused now,
+        // unless it is pinned and left for the collector to release, or another
+        // object may still point to it and only a trace can tell
+        if (count == 0 && __atomic_load_n(&current->pins, __ATOMIC_SEQ_CST) == 0 && !pool->tracing)
+        {
+            freeObject(pool, ref & REF_INDEX_MASK);
+        }
+    }
+    else if (ref > 0)
+    {
+        fprintf(stdout, "Could not find reference with id of '%lu'.\n", ref);
+    }
+    else
+    {
+        fprintf(stdout, "Reference id must be greater than zero current '%lu'.\n", ref);
+    }
+}
+
+//------------------------------------------------------
+// growPool
+//
+// PURPOSE: Commits more of the reserved address space to the old
+// space, doubling the pool and at least fitting the bytes needed.
+// Nothing moves, the new room is simply added above the old space.
+// The caller has exclusive access.
+// INPUT PARAMETERS:
+// pool - The pool being grown
+// needed - The number of bytes that have to fit
+// OUTPUT PARAMETERS:
+// Non-zero if the pool grew.
+//------------------------------------------------------
+static int growPool(ObjectPool *pool, const long needed)
+{
+    long target = (long) pool->size * 2;
+    int grown = 0;
+
+    if (target < pool->size + needed)
+    {
+        target = pool->size + needed;
+    }
+
+    if (target > pool->reserved)
+    {
+        target = pool->reserved;
+    }
+
+    if (target > pool->size)
+    {
+        size_t committed = roundToPage((size_t) pool->size);
+        size_t wanted = roundToPage((size_t) target);
+
+        if (wanted <= committed
+            || mprotect(pool->buffer + committed, wanted - committed, PROT_READ | PROT_WRITE) == 0)
+        {
+            pool->size = (int) target;
+            pool->old.end = (int) target;
+            grown = 1;
+
+            emitEvent(pool, GC_EVENT_GROW, NULL, NULL_REF, 0, 0, target, NULL);
+
+#ifdef MADV_HUGEPAGE
+            if (pool->hugePages && wanted > committed)
+            {
+                madvise(pool->buffer + committed, wanted - committed, MADV_HUGEPAGE);
+            }
+#endif
+        }
+        else
+        {
+            fprintf(stdout, "Could not grow the object pool to %ld bytes.\n", target);
+        }
+    }
+
+    return grown;
+}
+
+//------------------------------------------------------
+// missingBytes
+//
+// PURPOSE: Adds up the blocks of a batch that still have to be placed.
+// INPUT PARAMETERS:
+// pool - The pool the objects are inserted into
+// sizes - The sizes of the objects
+// out - The references of the objects, NULL_REF where still missing
+// n - The number of objects
+// alignment - The alignment of every object
+// OUTPUT PARAMETERS:
+// The bytes the missing objects take up, headers and padding included.
+//------------------------------------------------------
+static long missingBytes(ObjectPool *pool, const int *sizes, const Ref *out, const int n, const int alignment)
+{
+    long bytes = 0;
+    int i;
+
+    for (i = 0; i < n; i++)
+    {
+        // large objects need pages of their own, not room in the buffer
+        if (out[i] == NULL_REF && fitsPool(pool, sizes[i], alignment) && !IS_LARGE(pool, sizes[i]))
+        {
+            bytes += BLOCK_SIZE(sizes[i]) + ALIGN_SLACK(alignment);
+        }
+    }
+
+    return bytes;
+}
+
+//------------------------------------------------------
+// collectAndAllocate
+//
+// PURPOSE: Takes exclusive access to the pool, collects it unless
+// another thread already collected since the caller last looked, and
+// allocates the objects before any other thread can take the space.
+// A generational pool tries a minor collection before a full one when
+// the objects could fit in its nursery, so it can collect twice, and
+// a growable pool grows when a full one does not free enough.
+// INPUT PARAMETERS:
+// pool - The pool being collected
+// sizes - The sizes of the objects
+// out - The references of the objects, NULL_REF where still missing
+// n - The number of objects
+// alignment - The alignment of every object
+// seen - The number of collections the caller had seen
+// OUTPUT PARAMETERS:
+// The number of objects that did not fit even after collecting.
+//------------------------------------------------------
+static int collectAndAllocate(ObjectPool *pool, const int *sizes, Ref *out, const int n, const int alignment,
+    const unsigned long seen)
+{
+    int missing = 1;
+
+    beginExclusive(pool);
+
+    if (pool->collections != seen)
+    {
+        missing = allocateBatch(pool, sizes, out, n, alignment, 0);
+    }
+
+    // emptying the nursery cannot make room for more than it holds, the full collection would follow anyway
+    if (missing > 0 && GENERATIONAL(pool)
+        && missingBytes(pool, sizes, out, n, alignment) <= pool->nursery.end - pool->nursery.start)
+    {
+        minorCollection(pool);
+
+        missing = allocateBatch(pool, sizes, out, n, alignment, 0);
+
+        // the survivors can leave too little room in the nursery, the objects then start out old
+        if (missing > 0)
+        {
+            missing = allocateBatch(pool, sizes, out, n, alignment, 1);
+        }
+    }
+
+    if (missing > 0)
+    {
+        compact(pool);
+
+        // a pool that is still crowded after compacting grows rather than compacting again soon
+        if (pool->size < pool->reserved
+            && (pool->old.end - pool->old.top) - missingBytes(pool, sizes, out, n, alignment)
+                < (pool->old.end - pool->old.start) / GROW_FREE_SHARE)
+        {
+            growPool(pool, missingBytes(pool, sizes, out, n, alignment));
+        }
+
+        missing = allocateBatch(pool, sizes, out, n, alignment, 0);
+
+        if (missing > 0 && GENERATIONAL(pool))
+        {
+            missing = allocateBatch(pool, sizes, out, n, alignment, 1);
+        }
+    }
+
+    endExclusive(pool);
+
+    return missing;
+}
+
+//------------------------------------------------------
+// stepCollection
+//
+// PURPOSE: Compacts the old space for at most the given time, starting
+// a compaction if none is under way. At least one block is visited
+// by every step, so repeated steps always finish. Steps run by the
+// pool itself come here, those asked for go through poolCollectStep.
+// INPUT PARAMETERS:
+// pool - The pool being compacted
+// budgetMicros - Microseconds the step may take, 0 finishes the compaction
+// OUTPUT PARAMETERS:
+// 1 if the compaction still has blocks to visit, 0 once it is done.
+//------------------------------------------------------
+static int stepCollection(ObjectPool *pool, const long budgetMicros)
+{
+    verifyState(pool);
+    int more = 0;
+
+    if (holdsAccess(NULL))
+    {
+        fprintf(stdout, "Cannot compact a pool while holding access to a pool.\n");
+    }
+    else
+    {
+        struct timespec deadline;
+        struct timespec started;
+
+        beginExclusive(pool);
+
+        // the budget is for the step itself, not for waiting on the threads to leave
+        clock_gettime(CLOCK_MONOTONIC, &deadline);
+        deadline.tv_sec += budgetMicros / 1000000;
+        deadline.tv_nsec += (budgetMicros % 1000000) * 1000;
+
+        if (deadline.tv_nsec >= 1000000000)
+        {
+            deadline.tv_sec++;
+            deadline.tv_nsec -= 1000000000;
+        }
+
+        beginPause(pool, "INCREMENTAL COMPACTION", &started);
+
+        prepareCollection(pool);
+
+        if (!pool->compacting)
+        {
+            beginSlide(pool);
+
+            // a compaction that is to finish now can be shared with the GC threads
+            if (budgetMicros <= 0)
+            {
+                slideInParallel(pool);
+            }
+        }
+
+        if (!pool->compacting || slideStep(pool, budgetMicros > 0 ? &deadline : NULL))
+        {
+            // grouping walks the whole old space, too much for a step with a budget
+            if (pool->hotGrouping && budgetMicros <= 0)
+            {
+                groupHotObjects(pool, &pool->cycleCounts);
+            }
+
+            sweepLargeObjects(pool, &pool->cycleCounts);
+
+            releaseTail(pool, &pool->cycleCounts);
+
+            finishCollection(pool, "INCREMENTAL COMPACTION", &pool->cycleCounts);
+        }
+        else
+        {
+            more = 1;
+        }
+
+        recordPause(pool, "INCREMENTAL COMPACTION", &started);
+
+        endExclusive(pool);
+    }
+
+    return more;
+}
+
+//------------------------------------------------------
+// nurseryFilling
+//
+// PURPOSE: Checks whether the nursery of a generational pool is close
+// enough to full that the background collector should empty it.
+// INPUT PARAMETERS:
+// pool - The pool being checked
+// OUTPUT PARAMETERS:
+// 1 if the nursery should be collected, 0 otherwise.
+//------------------------------------------------------
+static int nurseryFilling(ObjectPool *pool)
+{
+    int filling = 0;
+
+    if (GENERATIONAL(pool))
+    {
+        // the nursery top moves under the allocation lock, and in collections
+        enterPool(pool);
+        lockAllocation(pool);
+
+        filling = pool->nursery.end - pool->nursery.top
+            < (pool->nursery.end - pool->nursery.start) / PACING_FILL_SHARE;
+
+        unlockAllocation(pool);
+        leavePool(pool);
+    }
+
+    return filling;
+}
+
+//------------------------------------------------------
+// runCollector
+//
+// PURPOSE: The body of the background collector thread. It empties
+// the nursery before inserts find it full and runs the compaction
+// steps that inserts would otherwise pay for, letting the inserting
+// threads back in between steps.
+// INPUT PARAMETERS:
+// arg - The pool being collected
+//------------------------------------------------------
+static void *runCollector(void *arg)
+{
+    ObjectPool* pool = (ObjectPool*) arg;
+    long budget = pool->pauseBudget > 0 ? pool->pauseBudget : BACKGROUND_STEP_MICROS;
+
+    while (!__atomic_load_n(&pool->collectorStop, __ATOMIC_ACQUIRE))
+    {
+        struct timespec wake;
+
+        clock_gettime(CLOCK_REALTIME, &wake);
+        wake.tv_nsec += BACKGROUND_POLL_MICROS * 1000L;
+
+        if (wake.tv_nsec >= 1000000000)
+        {
+            wake.tv_sec++;
+            wake.tv_nsec -= 1000000000;
+        }
+
+        pthread_mutex_lock(&pool->collectorLock);
+
+        if (!__atomic_load_n(&pool->collectorStop, __ATOMIC_ACQUIRE) && !__atomic_load_n(&pool->stepDue, __ATOMIC_RELAXED))
+        {
+            pthread_cond_timedwait(&pool->collectorWake, &pool->collectorLock, &wake);
+        }
+
+        pthread_mutex_unlock(&pool->collectorLock);
+
+        if (nurseryFilling(pool))
+        {
+            beginExclusive(pool);
+            minorCollection(pool);
+            endExclusive(pool);
+        }
+
+        while (__atomic_load_n(&pool->stepDue, __ATOMIC_RELAXED)
+            && !__atomic_load_n(&pool->collectorStop, __ATOMIC_ACQUIRE))
+        {
+            stepCollection(pool, budget);
+            sched_yield();
+        }
+    }
+
+    return NULL;
+}
+
+//------------------------------------------------------
+// reserveBuffer
+//
+// PURPOSE: Reserves address space for a pool buffer without committing
+// any memory to it. Reservations of a huge page or more start on a
+// huge page boundary, so huge pages can back them.
+// INPUT PARAMETERS:
+// reserve - The number of bytes to reserve, a whole number of pages
+// OUTPUT PARAMETERS:
+// The reserved address space or MAP_FAILED.
+//------------------------------------------------------
+static void *reserveBuffer(const size_t reserve)
+{
+    size_t slack = reserve >= HUGE_PAGE ? HUGE_PAGE : 0;
+    unsigned char* buffer = mmap(NULL, reserve + slack, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+
+    if (buffer != MAP_FAILED && slack > 0)
+    {
+        size_t head = (HUGE_PAGE - ((size_t) buffer % HUGE_PAGE)) % HUGE_PAGE;
+
+        // trim the reservation down to an aligned range of the size asked for
+        if (head > 0)
+        {
+            munmap(buffer, head);
+        }
+
+        munmap(buffer + head + reserve, slack - head);
+
+        buffer += head;
+    }
+
+    return buffer;
+}
+
+//------------------------------------------------------
+// createPool
+//
+// PURPOSE: Creates a new, empty object pool that is independent
+// of every other pool.
+// INPUT PARAMETERS:
+// bytes - The number of bytes of memory the pool manages
+// OUTPUT PARAMETERS:
+// Either the new pool or NULL if it could not be allocated.
+//------------------------------------------------------
+ObjectPool *createPool( size_t bytes )
+{
+    return createGrowablePool(bytes, bytes);
+}
+
+//------------------------------------------------------
+// createGrowablePool
+//
+// PURPOSE: Creates a new, empty object pool that starts out managing
+// initialBytes and grows in place up to maximumBytes. Address space
+// for the maximum is reserved now, pages are committed as it grows.
+// INPUT PARAMETERS:
+// initialBytes - The number of bytes the pool manages to begin with
+// maximumBytes - The number of bytes the pool can grow to
+// OUTPUT PARAMETERS:
+// Either the new pool or NULL if it could not be allocated.
+//------------------------------------------------------
+ObjectPool *createGrowablePool( size_t initialBytes, size_t maximumBytes )
+{
+    ObjectPool* pool = NULL;
+
+    if (maximumBytes < initialBytes)
+    {
+        maximumBytes = initialBytes;
+    }
+
+    assert(maximumBytes <= INT_MAX);
+
+    if (maximumBytes <= INT_MAX)
+    {
+        // the reader shards must each start on their own cache line
+        if (posix_memalign((void**) &pool, CACHE_LINE, sizeof(ObjectPool)) != 0)
+        {
+            pool = NULL;
+        }
+
+        if (pool != NULL_REF)
+        {
+            // reserve at least a page, so even an empty pool has an address to hand out
+            size_t reserve = roundToPage(maximumBytes > 0 ? maximumBytes : 1);
+            size_t commit = roundToPage(initialBytes);
+            void* buffer;
+
+            memset(pool, 0, sizeof(ObjectPool));
+
+            buffer = reserveBuffer(reserve);
+
+            if (buffer != MAP_FAILED && commit > 0 && mprotect(buffer, commit, PROT_READ | PROT_WRITE) != 0)
+            {
+                munmap(buffer, reserve);
+                buffer = MAP_FAILED;
+            }
+
+            pool->buffer = buffer != MAP_FAILED ? (unsigned char *) buffer : NULL_REF;
+            pool->size = (int) initialBytes;
+            pool->reserved = (int) maximumBytes;
+            pool->retainBytes = DEFAULT_RETAIN_BYTES;
+            pool->old.end = (int) initialBytes;
+            pool->promotionAge = 1;
+            pool->handlesUsed = 1;
+            clearFreeLists(pool);
+            pool->tlabSize = ALIGN_DOWN((int) (initialBytes / TLAB_SHARE));
+
+            if (pool->tlabSize > TLAB_SIZE)
+            {
+                pool->tlabSize = TLAB_SIZE;
+            }
+
+            pthread_mutex_init(&pool->allocLock, NULL);
+            pthread_mutex_init(&pool->gcLock, NULL);
+            pthread_mutex_init(&pool->collectorLock, NULL);
+            pthread_mutex_init(&pool->recordingLock, NULL);
+            pthread_mutex_init(&pool->helperLock, NULL);
+            pthread_cond_init(&pool->collectorWake, NULL);
+            pthread_cond_init(&pool->helperWake, NULL);
+            pthread_cond_init(&pool->helperDone, NULL);
+            pool->gcThreads = 1;
+            pool->alignment = GRANULE;
+            pool->skipWords = chooseSkipWords(1);
+
+            if (pool->buffer == NULL_REF)
+            {
+                pthread_mutex_destroy(&pool->allocLock);
+                pthread_mutex_destroy(&pool->gcLock);
+                pthread_mutex_destroy(&pool->collectorLock);
+                pthread_mutex_destroy(&pool->recordingLock);
+                pthread_mutex_destroy(&pool->helperLock);
+                pthread_cond_destroy(&pool->collectorWake);
+                pthread_cond_destroy(&pool->helperWake);
+                pthread_cond_destroy(&pool->helperDone);
+                free(pool);
+                pool = NULL;
+            }
+        }
+
+        assert(pool != NULL_REF);
+
+        if (pool == NULL_REF)
+        {
+            fprintf(stdout, "Failed to dynnamically allocate memory for object pool.\n");
+        }
+    }
+    else
+    {
+        fprintf(stdout, "object pool size exceeds %d bytes.\n", INT_MAX);
+    }
+
+    return pool;
+}
+
+//------------------------------------------------------
+// deletePool
+//
+// PURPOSE: Releases a pool created by createPool along with every
+// object stored in it.
+// INPUT PARAMETERS:
+// pool - The pool being released, NULL is ignored
+//------------------------------------------------------
+void deletePool( ObjectPool *pool )
+{
+    if (pool != NULL_REF)
+    {
+        // To clean up we must stop the collector, the GC helpers and the recording and release the large objects, the slabs of the handle table and the buffer.
+        unsigned long slab;
+        unsigned long index;
+
+        setPoolBackgroundCollection(pool, 0);
+        setPoolGcThreads(pool, 1);
+        setPoolRecording(pool, NULL);
+
+        for (index = nextSlot(pool, 1, LARGE_SLOTS); index < pool->handlesUsed; index = nextSlot(pool, index + 1, LARGE_SLOTS))
+        {
+            freeLargeObject(pool, index);
+        }
+
+        for (slab = 0; slab < pool->slabCount; slab++)
+        {
+            free(pool->slabs[slab]);
+            free(pool->slabBits[slab]);
+        }
+
+        if(pool->slabs != NULL_REF) free(pool->slabs);
+        if(pool->slabBits != NULL_REF) free(pool->slabBits);
+
+        free(pool->markStack);
+        free(pool->rememberedSet);
+
+        if(pool->buffer != NULL_REF) munmap(pool->buffer, roundToPage(pool->reserved > 0 ? pool->reserved : 1));
+
+        pthread_mutex_destroy(&pool->allocLock);
+        pthread_mutex_destroy(&pool->gcLock);
+        pthread_mutex_destroy(&pool->collectorLock);
+        pthread_mutex_destroy(&pool->recordingLock);
+        pthread_mutex_destroy(&pool->helperLock);
+        pthread_cond_destroy(&pool->collectorWake);
+        pthread_cond_destroy(&pool->helperWake);
+        pthread_cond_destroy(&pool->helperDone);
+
+        free(pool);
+    }
+}
+
+//------------------------------------------------------
+// setPoolConcurrent
+//
+// PURPOSE: Turns the thread-safe mode of a pool on or off. Must be
+// called before the pool is shared between threads.
+// INPUT PARAMETERS:
+// pool - The pool being changed
+// enabled - Non-zero to make the pool safe to share
+//------------------------------------------------------
+void setPoolConcurrent( ObjectPool *pool, int enabled )
+{
+    verifyState(pool);
+
+    pool->concurrent = (enabled != 0);
+}
+
+//------------------------------------------------------
+// setPoolBackgroundCollection
+//
+// PURPOSE: Starts or stops a thread that collects a concurrent pool in
+// the background. Must be called before the pool is shared between
+// threads, or after they are done with it.
+// INPUT PARAMETERS:
+// pool - The pool being changed
+// enabled - Non-zero to start the collector, zero to stop it
+//------------------------------------------------------
+void setPoolBackgroundCollection( ObjectPool *pool, int enabled )
+{
+    verifyState(pool);
+
+    if (enabled && !pool->concurrent)
+    {
+        fprintf(stdout, "Background collection needs a concurrent pool.\n");
+    }
+    else if (enabled && !pool->collectorRunning)
+    {
+        pool->collectorStop = 0;
+        pool->collectorRunning = 1;
+
+        if (pthread_create(&pool->collector, NULL, runCollector, pool) != 0)
+        {
+            pool->collectorRunning = 0;
+
+            fprintf(stdout, "Could not start the background collector.\n");
+        }
+    }
+    else if (!enabled && pool->collectorRunning)
+    {
+        __atomic_store_n(&pool->collectorStop, 1, __ATOMIC_RELEASE);
+
+        pthread_mutex_lock(&pool->collectorLock);
+        pthread_cond_signal(&pool->collectorWake);
+        pthread_mutex_unlock(&pool->collectorLock);
+
+        pthread_join(pool->collector, NULL);
+
+        pool->collectorRunning = 0;
+
+        // steps left due are only for inserts to pay for when they have a budget
+        if (pool->pauseBudget == 0)
+        {
+            __atomic_store_n(&pool->stepDue, 0, __ATOMIC_RELAXED);
+        }
+    }
+}
+
+//------------------------------------------------------
+// setPoolRetainBytes
+//
+// PURPOSE: Sets how many free bytes above the live data a compaction
+// keeps resident before giving the rest of the pages back.
+// INPUT PARAMETERS:
+// pool - The pool being changed
+// bytes - The free bytes to keep, INT_MAX never gives pages back
+//------------------------------------------------------
+void setPoolRetainBytes( ObjectPool *pool, size_t bytes )
+{
+    verifyState(pool);
+
+    pool->retainBytes = bytes < (size_t) INT_MAX ? (int) bytes : INT_MAX;
+}
+
+//------------------------------------------------------
+// setPoolHugePages
+//
+// PURPOSE: Asks the system to back the pool with transparent huge
+// pages, cutting TLB misses on large pools. Pages are then given back
+// in whole huge pages. Does nothing where huge pages are unsupported.
+// INPUT PARAMETERS:
+// pool - The pool being changed
+// enabled - Non-zero to ask for huge pages
+//------------------------------------------------------
+void setPoolHugePages( ObjectPool *pool, int enabled )
+{
+    verifyState(pool);
+
+#ifdef MADV_HUGEPAGE
+    size_t committed = roundToPage((size_t) pool->size);
+
+    pool->hugePages = (enabled != 0);
+
+    if (committed > 0)
+    {
+        madvise(pool->buffer, committed, pool->hugePages ? MADV_HUGEPAGE : MADV_NOHUGEPAGE);
+    }
+#else
+    (void) enabled;
+#endif
+}
+
+//------------------------------------------------------
+// setPoolGenerational
+//
+// PURPOSE: Splits an empty pool into a nursery for new objects and an
+// old space for objects that survive, or joins them back together.
+// INPUT PARAMETERS:
+// pool - The pool being changed, it must not hold any objects yet
+// nurseryBytes - The size of the nursery, 0 turns generations off
+// promotionAge - The minor collections an object survives before it
+// is promoted to the old space
+//------------------------------------------------------
+void setPoolGenerational( ObjectPool *pool, size_t nurseryBytes, int promotionAge )
+{
+    verifyState(pool);
+
+    int empty = (pool->old.top == pool->old.start && pool->nursery.top == pool->nursery.start);
+
+    assert(empty);
+
+    if (!empty)
+    {
+        fprintf(stdout, "Generations can only be set up on an empty pool.\n");
+    }
+    else if (nurseryBytes >= (size_t) pool->size / 2)
+    {
+        fprintf(stdout, "Nursery of %lu bytes does not leave room for the old space.\n", (unsigned long) nurseryBytes);
+    }
+    else
+    {
+        int nursery = ALIGN_DOWN((int) nurseryBytes);
+
+        pool->nursery.start = 0;
+        pool->nursery.top = 0;
+        pool->nursery.end = nursery;
+
+        pool->old.start = nursery;
+        pool->old.top = nursery;
+        pool->old.end = pool->size;
+
+        pool->promotionAge = promotionAge > 0 ? promotionAge : 1;
+    }
+}
+
+//------------------------------------------------------
+// setPoolPauseBudget
+//
+// PURPOSE: Sets how long one compaction step may pause the pool.
+// With a budget the old space is compacted a step per insert once it
+// fills up, instead of all at once when an insert finds it full.
+// A compaction left half done by turning stepping off is started
+// over by the next full collection.
+// INPUT PARAMETERS:
+// pool - The pool being changed
+// budgetMicros - Microseconds per step, 0 turns stepping off
+//------------------------------------------------------
+void setPoolPauseBudget( ObjectPool *pool, long budgetMicros )
+{
+    verifyState(pool);
+
+    assert(budgetMicros >= 0);
+
+    pool->pauseBudget = budgetMicros > 0 ? budgetMicros : 0;
+
+    // a step still due would otherwise run as a whole compaction on the next insert
+    if (pool->pauseBudget == 0 && !pool->collectorRunning)
+    {
+        __atomic_store_n(&pool->stepDue, 0, __ATOMIC_RELAXED);
+    }
+}
+
+//------------------------------------------------------
+// poolCollectStep
+//
+// PURPOSE: Runs one compaction step on behalf of the caller, see
+// stepCollection.
+// INPUT PARAMETERS:
+// pool - The pool being compacted
+// budgetMicros - Microseconds the step may take, 0 finishes the compaction
+// OUTPUT PARAMETERS:
+// 1 if the compaction still has blocks to visit, 0 once it is done.
+//------------------------------------------------------
+int poolCollectStep( ObjectPool *pool, long budgetMicros )
+{
+    verifyState(pool);
+
+    recordCall(pool, POOL_CALL_COLLECT_STEP, NULL_REF, (int) budgetMicros, 0);
+
+    return stepCollection(pool, budgetMicros);
+}
+
+//------------------------------------------------------
+// setPoolTracing
+//
+// PURPOSE: Turns tracing on or off. A tracing pool keeps the objects
+// it can reach from those with references or pins, following their
+// reference slots, rather than every object with references.
+// INPUT PARAMETERS:
+// pool - The pool being changed
+// enabled - Non-zero to decide liveness by tracing
+//------------------------------------------------------
+void setPoolTracing( ObjectPool *pool, int enabled )
+{
+    verifyState(pool);
+
+    // objects inserted before may already point into the nursery, the first minor collection finds them
+    if (enabled && !pool->tracing)
+    {
+        pool->rememberedOverflow = 1;
+    }
+
+    pool->tracing = (enabled != 0);
+
+    recordCall(pool, POOL_CALL_SET_TRACING, NULL_REF, pool->tracing, 0);
+}
+
+//------------------------------------------------------
+// setPoolHotGrouping
+//
+// PURPOSE: Turns hot grouping on or off. A grouping pool counts the
+// retrieves of every object, and full compactions move the objects
+// retrieved most since the last one next to each other.
+// INPUT PARAMETERS:
+// pool - The pool being changed
+// enabled - Non-zero to group hot objects
+//------------------------------------------------------
+void setPoolHotGrouping( ObjectPool *pool, int enabled )
+{
+    verifyState(pool);
+
+    pool->hotGrouping = (enabled != 0);
+}
+
+//------------------------------------------------------
+// setPoolVectorScans
+//
+// PURPOSE: Turns the vector scans of the side tables on or off. They
+// are on by default on processors with AVX2 or AVX-512.
+// INPUT PARAMETERS:
+// pool - The pool being changed
+// enabled - Non-zero to scan with vectors where the processor has them
+// OUTPUT PARAMETERS:
+// The number of side table words a scan now skips at once.
+//------------------------------------------------------
+int setPoolVectorScans( ObjectPool *pool, int enabled )
+{
+    verifyState(pool);
+
+    pool->skipWords = chooseSkipWords(enabled);
+
+#ifdef VECTOR_SCANS
+    if (pool->skipWords == skipWordsAvx512)
+    {
+        return 8;
+    }
+
+    if (pool->skipWords == skipWordsAvx2)
+    {
+        return 4;
+    }
+#endif
+
+    return 1;
+}
+
+//------------------------------------------------------
+// setPoolAlignment
+//
+// PURPOSE: Sets the alignment of the objects inserted without asking
+// for one.
+// INPUT PARAMETERS:
+// pool - The pool being changed
+// alignment - A power of two of up to MAX_ALIGNMENT, anything below a
+// granule gets the alignment of a granule
+//------------------------------------------------------
+void setPoolAlignment( ObjectPool *pool, int alignment )
+{
+    verifyState(pool);
+
+    if (alignment < GRANULE)
+    {
+        alignment = GRANULE;
+    }
+
+    if (alignment > MAX_ALIGNMENT || (alignment & (alignment - 1)) != 0)
+    {
+        fprintf(stdout, "alignment %d is not a power of two of at most %d.\n", alignment, MAX_ALIGNMENT);
+    }
+    else
+    {
+        pool->alignment = alignment;
+
+        recordCall(pool, POOL_CALL_SET_ALIGNMENT, NULL_REF, alignment, 0);
+    }
+}
+
+//------------------------------------------------------
+// setPoolLargeObjectSize
+//
+// PURPOSE: Sets the size from which objects go to the large-object
+// space, each in pages of its own that no collection copies.
+// INPUT PARAMETERS:
+// pool - The pool being changed
+// bytes - The smallest large object, 0 to keep every object in the buffer
+//------------------------------------------------------
+void setPoolLargeObjectSize( ObjectPool *pool, int bytes )
+{
+    verifyState(pool);
+
+    pool->largeObjectSize = bytes > 0 ? bytes : 0;
+}
+
+//------------------------------------------------------
+// setPoolGcThreads
+//
+// PURPOSE: Sets how many threads share the work of a collection,
+// starting or stopping helper threads to match. They mark tracing
+// pools and slide the old space of full compactions.
+// INPUT PARAMETERS:
+// pool - The pool being changed
+// threads - The number of GC threads, the collecting thread included
+//------------------------------------------------------
+void setPoolGcThreads( ObjectPool *pool, int threads )
+{
+    verifyState(pool);
+    int i;
+
+    if (threads < 1)
+    {
+        threads = 1;
+    }
+
+    if (threads > MAX_GC_THREADS)
+    {
+        threads = MAX_GC_THREADS;
+    }
+
+    if (pool->gcWorkers != NULL_REF)
+    {
+        pthread_mutex_lock(&pool->helperLock);
+        pool->helperStop = 1;
+        pthread_cond_broadcast(&pool->helperWake);
+        pthread_mutex_unlock(&pool->helperLock);
+
+        for (i = 1; i < pool->gcThreads; i++)
+        {
+            pthread_join(pool->gcWorkers[i].thread, NULL);
+        }
+
+        for (i = 0; i < pool->gcThreads; i++)
+        {
+            MarkArray* array = pool->gcWorkers[i].array;
+
+            while (array != NULL_REF)
+            {
+                MarkArray* retired = array->retired;
+
+                free(array);
+                array = retired;
+            }
+        }
+
+        free(pool->gcWorkers);
+
+        pool->gcWorkers = NULL_REF;
+        pool->gcThreads = 1;
+        pool->helperStop = 0;
+    }
+
+    if (threads > 1)
+    {
+        if (posix_memalign((void**) &pool->gcWorkers, CACHE_LINE, threads * sizeof(GcWorker)) != 0)
+        {
+            pool->gcWorkers = NULL_REF;
+
+            fprintf(stdout, "Could not allocate the GC threads.\n");
+        }
+        else
+        {
+            memset(pool->gcWorkers, 0, threads * sizeof(GcWorker));
+
+            for (i = 0; i < threads; i++)
+            {
+                pool->gcWorkers[i].pool = pool;
+                pool->gcWorkers[i].id = i;
+
+                // a helper that is slow to start must still take part in the next round
+                pool->gcWorkers[i].round = pool->helperRound;
+            }
+
+            // gcThreads only counts the helpers that started
+            for (i = 1; i < threads; i++)
+            {
+                if (pthread_create(&pool->gcWorkers[i].thread, NULL, runHelper, &pool->gcWorkers[i]) != 0)
+                {
+                    fprintf(stdout, "Could only start %d GC threads.\n", i);
+                    break;
+                }
+            }
+
+            pool->gcThreads = i;
+        }
+    }
+}
+
+//------------------------------------------------------
+// beginPoolAccess
+//
+// PURPOSE: Keeps the collector from running on a pool so pointers
+// from poolRetrieveObject stay valid until endPoolAccess.
+// INPUT PARAMETERS:
+// pool - The pool being accessed
+//------------------------------------------------------
+void beginPoolAccess( ObjectPool *pool )
+{
+    verifyState(pool);
+
+    assert(heldCount < MAX_HELD_ACCESS);
+
+    if (heldCount < MAX_HELD_ACCESS)
+    {
+        enterPool(pool);
+
+        heldPools[heldCount++] = pool;
+    }
+    else
+    {
+        fprintf(stdout, "Thread holds too many pool accesses.\n");
+    }
+}
+
+//------------------------------------------------------
+// endPoolAccess
+//
+// PURPOSE: Gives up access taken by beginPoolAccess.
+// INPUT PARAMETERS:
+// pool - The pool that was being accessed
+//------------------------------------------------------
+void endPoolAccess( ObjectPool *pool )
+{
+    int i = heldCount - 1;
+
+    while (i >= 0 && heldPools[i] != pool)
+    {
+        i--;
+    }
+
+    assert(i >= 0);
+
+    if (i >= 0)
+    {
+        heldPools[i] = heldPools[--heldCount];
+
+        leavePool(pool);
+    }
+    else
+    {
+        fprintf(stdout, "Thread does not hold access to the pool.\n");
+    }
+}
+
+//------------------------------------------------------
+// insertAligned
+//
+// PURPOSE: Attemps to insert an object into the pool that starts on a
+// multiple of the given alignment. Collections keep it aligned. The
+// callers record the insert, each as the call it was.
+// INPUT PARAMETERS:
+// pool - The pool the object is inserted into
+// size - The size of the object that is being inserted into the
+// object pool.
+// alignment - A power of two of up to MAX_ALIGNMENT, anything below a
+// granule gets the alignment of a granule
+// OUTPUT PARAMETERS:
+// Either the reference that was inserted into the pool or NULL_REF
+// if we could not allocate memory for the object.
+//------------------------------------------------------
+static Ref insertAligned(ObjectPool *pool, const int size, int alignment)
+{
+    Ref id = NULL_REF;
+
+    if (alignment < GRANULE)
+    {
+        alignment = GRANULE;
+    }
+
+    assert(size >= 0);
+    assert(alignment <= MAX_ALIGNMENT && (alignment & (alignment - 1)) == 0);
+
+    if (alignment > MAX_ALIGNMENT || (alignment & (alignment - 1)) != 0)
+    {
+        fprintf(stdout, "alignment %d is not a power of two of at most %d.\n", alignment, MAX_ALIGNMENT);
+    }
+    else if (size >= 0)
+    {
+        // headers and rounding take room too, so an object the size of the whole pool never fits
+        if (fitsPool(pool, size, alignment))
+        {
+            unsigned long seen;
+
+            // pay for a slice of the compaction under way rather than all of it when full,
+            // unless a background collector is doing the work
+            if (__atomic_load_n(&pool->stepDue, __ATOMIC_RELAXED) && !pool->collectorRunning
+                && !holdsAccess(NULL))
+            {
+                stepCollection(pool, pool->pauseBudget);
+            }
+
+            enterPool(pool);
+            seen = pool->collections;
+            id = allocateObject(pool, size, alignment);
+            leavePool(pool);
+
+            // Try to compact the pool, unless the caller is holding pointers into it
+            if (id == NULL_REF && !holdsAccess(NULL))
+            {
+                collectAndAllocate(pool, &size, &id, 1, alignment, seen);
+            }
+
+            if (id == NULL_REF)
+            {
+                __atomic_add_fetch(&pool->allocationFailures, 1, __ATOMIC_RELAXED);
+
+                emitEvent(pool, GC_EVENT_ALLOCATION_FAILURE, NULL, NULL_REF, 0, 0, size, NULL);
+
+                fprintf(stdout, "After compaction object pool is full cannot insert object of size %d.\n", size);
+            }
+        }
+        else
+        {
+            fprintf(stdout, "object exceddes memory size.\n");
+        }
+    }
+    else
+    {
+        fprintf(stdout, "size of inserted object is negative and is required to be k >= 0.\n");
+    }
+
+    return id;
+}
+
+//------------------------------------------------------
+// poolInsertAlignedObject
+//
+// PURPOSE: Attemps to insert an object into the pool that starts on a
+// multiple of the given alignment. Collections keep it aligned.
+// INPUT PARAMETERS:
+// pool - The pool the object is inserted into
+// size - The size of the object that is being inserted into the
+// object pool.
+// alignment - A power of two of up to MAX_ALIGNMENT, anything below a
+// granule gets the alignment of a granule
+// OUTPUT PARAMETERS:
+// Either the reference that was inserted into the pool or NULL_REF
+// if we could not allocate memory for the object.
+//------------------------------------------------------
+Ref poolInsertAlignedObject( ObjectPool *pool, const int size, int alignment )
+{
+    verifyState(pool);
+    Ref id = insertAligned(pool, size, alignment);
+
+    recordCall(pool, POOL_CALL_INSERT_ALIGNED, id, size, alignment);
+
+    return id;
+}
+
+//------------------------------------------------------
+// poolInsertOjbect
+//
+// PURPOSE: Attemps to insert an object into the pool, aligned as the
+// pool aligns objects by default.
+// INPUT PARAMETERS:
+// pool - The pool the object is inserted into
+// size - The size of the object that is being inserted into the
+// object pool.
+// OUTPUT PARAMETERS:
+// Either the reference that was inserted into the pool or NULL_REF
+// if we could not allocate memory for the object.
+//------------------------------------------------------
+Ref poolInsertObject( ObjectPool *pool, const int size )
+{
+    verifyState(pool);
+    Ref id = insertAligned(pool, size, pool->alignment);
+
+    recordCall(pool, POOL_CALL_INSERT, id, size, 0);
+
+    return id;
+}
+
+//------------------------------------------------------
+// poolRetrieveObject
+//
+// PURPOSE: Looks up an object in our pool to return the
+// address of the pointer.
+// INPUT PARAMETERS:
+// pool - The pool that owns the object
+// ref - The id we are looking for to find the value in.
+// OUTPUT PARAMETERS:
+// Either a pointer to the object or NULL_REF
+//------------------------------------------------------
+void *poolRetrieveObject( ObjectPool *pool, const Ref ref )
+{
+    verifyState(pool);
+    unsigned char * object = NULL_REF;
+
+    assert(ref > 0);
+
+    if (ref > 0)
+    {
+        Handle* current;
+
+        enterPool(pool);
+
+        current = findHandle(pool, ref);
+
+        if (current != NULL_REF)
+        {
+            assert(current->large != NULL_REF || (current->ref.address >= HEADER_SIZE && current->ref.address <= pool->size));
+
+            if (current->large != NULL_REF || (current->ref.address >= HEADER_SIZE && current->ref.address <= pool->size))
+            {
+                object = OBJECT_AT(pool, current);
+
+                assert(object != NULL_REF);
+
+                noteSlotWrites(pool, current, ref);
+
+                if (pool->hotGrouping && __atomic_load_n(&current->accesses, __ATOMIC_RELAXED) < HOT_ACCESS_LIMIT)
+                {
+                    __atomic_fetch_add(&current->accesses, 1, __ATOMIC_RELAXED);
+                }
+            }
+            else
+            {
+                fprintf(stdout, "Reference '%lu' points outside of the object pool.\n", ref);
+            }
+        }
+        else
+        {
+            fprintf(stdout, "Could not find reference with id of '%lu'.\n", ref);
+        }
+
+        leavePool(pool);
+    }
+    else
+    {
+        fprintf(stdout, "Reference id must be greater than zero current '%lu'.\n", ref);
+    }
+
+    return object;
+}
+
+//------------------------------------------------------
+// poolPinObject
+//
+// PURPOSE: Stops the collector from moving an object, so the pointer
+// to it stays valid until the object is unpinned.
+// INPUT PARAMETERS:
+// pool - The pool that owns the object
+// ref - The reference of the object being pinned
+// OUTPUT PARAMETERS:
+// A pointer to the object or NULL if the reference is unknown.
+//------------------------------------------------------
+void *poolPinObject( ObjectPool *pool, const Ref ref )
+{
+    verifyState(pool);
+    unsigned char * object = NULL_REF;
+    Handle* current;
+
+    enterPool(pool);
+
+    current = ref > 0 ? findHandle(pool, ref) : NULL_REF;
+
+    if (current != NULL_REF)
+    {
+        // the pin lands before the pool is left, so no collection can miss it
+        __atomic_add_fetch(&current->pins, 1, __ATOMIC_SEQ_CST);
+
+        object = OBJECT_AT(pool, current);
+
+        noteSlotWrites(pool, current, ref);
+    }
+    else
+    {
+        fprintf(stdout, "Could not find reference with id of '%lu'.\n", ref);
+    }
+
+    leavePool(pool);
+
+    recordCall(pool, POOL_CALL_PIN, ref, 0, 0);
+
+    return object;
+}
+
+//------------------------------------------------------
+// poolUnpinObject
+//
+// PURPOSE: Undoes one poolPinObject, letting the collector move the
+// object again once every pin is gone. An object whose last reference
+// was dropped while pinned is released by the next collection.
+// INPUT PARAMETERS:
+// pool - The pool that owns the object
+// ref - The reference of the object being unpinned
+//------------------------------------------------------
+void poolUnpinObject( ObjectPool *pool, const Ref ref )
+{
+    verifyState(pool);
+    Handle* current;
+
+    recordCall(pool, POOL_CALL_UNPIN, ref, 0, 0);
+
+    enterPool(pool);
+
+    current = ref > 0 ? findHandle(pool, ref) : NULL_REF;
+
+    assert(current == NULL_REF || current->pins > 0);
+
+    if (current != NULL_REF && current->pins > 0)
+    {
+        __atomic_sub_fetch(&current->pins, 1, __ATOMIC_SEQ_CST);
+    }
+    else
+    {
+        fprintf(stdout, "Reference '%lu' is not pinned.\n", ref);
+    }
+
+    leavePool(pool);
+}
+
+//------------------------------------------------------
+// poolInsertTracedObject
+//
+// PURPOSE: Inserts an object that starts with reference slots, Refs
+// to other objects that a tracing pool follows when marking. The
+// slots start out as NULL_REF and are written through the pointer
+// to the object like the rest of it.
+// INPUT PARAMETERS:
+// pool - The pool the object is inserted into
+// size - The size of the object, slots included
+// slots - The number of Refs at the start of the object
+// OUTPUT PARAMETERS:
+// Either the reference that was inserted into the pool or NULL_REF
+// if it could not be inserted.
+//------------------------------------------------------
+Ref poolInsertTracedObject( ObjectPool *pool, const int size, const int slots )
+{
+    verifyState(pool);
+    Ref id = NULL_REF;
+
+    assert(slots >= 0 && (long) slots * (long) sizeof(Ref) <= size);
+
+    if (slots >= 0 && (long) slots * (long) sizeof(Ref) <= size)
+    {
+        id = insertAligned(pool, size, pool->alignment);
+
+        if (id != NULL_REF)
+        {
+            Handle* current;
+
+            enterPool(pool);
+
+            // a trace before the slots are set only sees an object without any
+            current = findHandle(pool, id);
+            memset(OBJECT_AT(pool, current), 0, slots * sizeof(Ref));
+            current->slots = slots;
+
+            leavePool(pool);
+        }
+    }
+    else
+    {
+        fprintf(stdout, "%d reference slots do not fit in an object of size %d.\n", slots, size);
+    }
+
+    recordCall(pool, POOL_CALL_INSERT_TRACED, id, size, slots);
+
+    return id;
+}
+
+//------------------------------------------------------
+// poolAddReference
+//
+// PURPOSE: Increments a refernce that is in the pool
+// INPUT PARAMETERS:
+// pool - The pool that owns the object
+// ref the refernce that is being incremented
+//------------------------------------------------------
+void poolAddReference( ObjectPool *pool, const Ref ref )
+{
+    verifyState(pool);
+
+    enterPool(pool);
+
+    changeCount(pool, ref, 1);
+
+    leavePool(pool);
+
+    recordCall(pool, POOL_CALL_ADD_REFERENCE, ref, 0, 0);
+}
+
+//------------------------------------------------------
+// poolDropReference
+//
+// PURPOSE: Reduces the amount of refernces to an object in the pool.
+// When the last reference is dropped the object's block goes on a
+// free list for reuse.
+// INPUT PARAMETERS:
+// pool - The pool that owns the object
+// ref - The refece that is being decremented from the pool
+//------------------------------------------------------
+void poolDropReference( ObjectPool *pool, const Ref ref )
+{
+    verifyState(pool);
+
+    // recorded before the object can be freed, so a replay never sees its memory reused first
+    recordCall(pool, POOL_CALL_DROP_REFERENCE, ref, 0, 0);
+
+    enterPool(pool);
+
+    changeCount(pool, ref, -1);
+
+    leavePool(pool);
+}
+
+//------------------------------------------------------
+// poolInsertObjects
+//
+// PURPOSE: Inserts a batch of objects, taking the allocation lock
+// once for the batch and collecting for all of it at once rather than
+// partway through, see collectAndAllocate.
+// INPUT PARAMETERS:
+// pool - The pool the objects are inserted into
+// sizes - The sizes of the objects
+// out - Receives the reference of each object, NULL_REF for those
+// that could not be inserted
+// n - The number of objects
+// OUTPUT PARAMETERS:
+// The number of objects inserted.
+//------------------------------------------------------
+int poolInsertObjects( ObjectPool *pool, const int *sizes, Ref *out, const int n )
+{
+    verifyState(pool);
+    int missing = 0;
+    int invalid = 0;
+    int i;
+
+    assert(n >= 0 && (n == 0 || (sizes != NULL && out != NULL)));
+
+    for (i = 0; i < n; i++)
+    {
+        out[i] = NULL_REF;
+
+        if (!fitsPool(pool, sizes[i], pool->alignment))
+        {
+            fprintf(stdout, "object %d of the batch has size %d, which does not fit the pool.\n", i, sizes[i]);
+            invalid++;
+        }
+    }
+
+    if (n > 0)
+    {
+        unsigned long seen;
+
+        if (__atomic_load_n(&pool->stepDue, __ATOMIC_RELAXED) && !pool->collectorRunning
+            && !holdsAccess(NULL))
+        {
+            stepCollection(pool, pool->pauseBudget);
+        }
+
+        enterPool(pool);
+        seen = pool->collections;
+        missing = allocateBatch(pool, sizes, out, n, pool->alignment, 0);
+        leavePool(pool);
+
+        if (missing > 0 && !holdsAccess(NULL))
+        {
+            missing = collectAndAllocate(pool, sizes, out, n, pool->alignment, seen);
+        }
+
+        if (missing > 0)
+        {
+            __atomic_add_fetch(&pool->allocationFailures, (unsigned long) missing, __ATOMIC_RELAXED);
+
+            emitEvent(pool, GC_EVENT_ALLOCATION_FAILURE, NULL, NULL_REF, 0, 0,
+                missingBytes(pool, sizes, out, n, pool->alignment), NULL);
+
+            fprintf(stdout, "After compaction object pool is full cannot insert %d objects of the batch.\n", missing);
+        }
+    }
+
+    for (i = 0; i < n && pool->recording != NULL; i++)
+    {
+        recordCall(pool, POOL_CALL_INSERT, out[i], sizes[i], 0);
+    }
+
+    return n - missing - invalid;
+}
+
+//------------------------------------------------------
+// poolAddReferences / poolDropReferences
+//
+// PURPOSE: Adds or drops one reference to each object of a batch in a
+// single pass, entering the pool once for all of them.
+// INPUT PARAMETERS:
+// pool - The pool that owns the objects
+// refs - The references of the objects
+// n - The number of references
+//------------------------------------------------------
+void poolAddReferences( ObjectPool *pool, const Ref *refs, const int n )
+{
+    verifyState(pool);
+    int i;
+
+    assert(n >= 0 && (n == 0 || refs != NULL));
+
+    enterPool(pool);
+
+    for (i = 0; i < n; i++)
+    {
+        changeCount(pool, refs[i], 1);
+    }
+
+    leavePool(pool);
+
+    for (i = 0; i < n && pool->recording != NULL; i++)
+    {
+        recordCall(pool, POOL_CALL_ADD_REFERENCE, refs[i], 0, 0);
+    }
+}
+
+void poolDropReferences( ObjectPool *pool, const Ref *refs, const int n )
+{
+    verifyState(pool);
+    int i;
+
+    assert(n >= 0 && (n == 0 || refs != NULL));
+
+    for (i = 0; i < n && pool->recording != NULL; i++)
+    {
+        recordCall(pool, POOL_CALL_DROP_REFERENCE, refs[i], 0, 0);
+    }
+
+    enterPool(pool);
+
+    for (i = 0; i < n; i++)
+    {
+        changeCount(pool, refs[i], -1);
+    }
+
+    leavePool(pool);
+}
+
+//------------------------------------------------------
+// poolGetStats
+//
+// PURPOSE: Copies the counters of a pool, adding up the objects that
+// are live right now and how fragmented the free space is. Safe to
+// call while holding access to the pool.
+// INPUT PARAMETERS:
+// pool - The pool being measured
+// OUTPUT PARAMETERS:
+// stats - Receives the counters
+//------------------------------------------------------
+void poolGetStats( ObjectPool *pool, PoolStats *stats )
+{
+    verifyState(pool);
+
+    assert(stats != NULL);
+
+    if (stats != NULL)
+    {
+        unsigned long index;
+        long liveBlocks = 0;
+        long topFree;
+        long allFree;
+        int shard;
+
+        beginInspection(pool);
+
+        memcpy(stats, &pool->stats, sizeof(PoolStats));
+        stats->collections = pool->collections;
+        stats->allocationFailures = __atomic_load_n(&pool->allocationFailures, __ATOMIC_RELAXED);
+        stats->liveObjects = 0;
+        stats->liveBytes = 0;
+        stats->largeObjects = 0;
+        stats->largeBytes = 0;
+
+        // only the handles of live objects are read
+        for (index = nextSlot(pool, 1, USED_SLOTS); index < pool->handlesUsed; index = nextSlot(pool, index + 1, USED_SLOTS))
+        {
+            Handle* current = HANDLE_AT(pool, index);
+
+            if (liveSlot(pool, index))
+            {
+                stats->liveObjects++;
+                stats->liveBytes += current->ref.size;
+
+                if (current->large != NULL_REF)
+                {
+                    stats->largeObjects++;
+                    stats->largeBytes += roundToPage(current->ref.size > 0 ? (size_t) current->ref.size : 1);
+                }
+                else
+                {
+                    liveBlocks += BLOCK_SIZE(current->ref.size);
+                }
+            }
+        }
+
+        // free space in one piece is what is left above each space and in thread-local chunks
+        topFree = (pool->old.end - pool->old.top) + (pool->nursery.end - pool->nursery.top);
+
+        for (shard = 0; shard < READER_SHARDS; shard++)
+        {
+            topFree += pool->shards[shard].tlabEnd - pool->shards[shard].tlabTop;
+        }
+
+        allFree = pool->size - liveBlocks;
+        stats->fragmentation = allFree > topFree ? (double) (allFree - topFree) / allFree : 0.0;
+
+        endInspection(pool);
+    }
+}
+
+//------------------------------------------------------
+// setPoolVerbose
+//
+// PURPOSE: Turns the stats printed after every collection on or off.
+// INPUT PARAMETERS:
+// pool - The pool being changed
+// enabled - Non-zero to print the stats of every collection
+//------------------------------------------------------
+void setPoolVerbose( ObjectPool *pool, int enabled )
+{
+    verifyState(pool);
+
+    pool->verbose = (enabled != 0);
+}
+
+//------------------------------------------------------
+// setPoolEventHook
+//
+// PURPOSE: Registers the function called with every event of a pool,
+// replacing any earlier one.
+// INPUT PARAMETERS:
+// pool - The pool being watched
+// hook - The function to call, NULL to stop watching
+// context - Passed to every call of the hook
 //------------------------------------------------------
-static void verifyState(void)
+void setPoolEventHook( ObjectPool *pool, GcEventHook hook, void *context )
 {
-    assert(buffer != NULL);
+    verifyState(pool);
+
+    pool->eventHook = hook;
+    pool->eventContext = context;
 }
 
 //------------------------------------------------------
-// compact
+// setPoolRecording
 //
-// PURPOSE: Runs the mark and compact algorithm on the object pool
+// PURPOSE: Starts writing the calls made on a pool to a file, after
+// how the pool is set up, or stops and closes the file of the
+// recording under way.
+// INPUT PARAMETERS:
+// pool - The pool being recorded
+// path - The file to write the recording to, NULL to stop recording
+// OUTPUT PARAMETERS:
+// 1 if the pool is now doing what was asked, 0 if the file could not
+// be opened.
 //------------------------------------------------------
-static void compact(void)
+int setPoolRecording( ObjectPool *pool, const char *path )
 {
-    verifyState();
-    unsigned char* temp = NULL_REF;
-
-    int newFreePtr = 0;
-    int bytesUsed = 0;
-    int bytesCollected = 0;
-
-    Node* newTop = NULL_REF;
-
-    temp = (unsigned char*)  malloc(MEMORY_SIZE * sizeof(unsigned char));
+    verifyState(pool);
+    int result = 1;
 
-    assert(temp != NULL_REF);
-
-    if (temp != NULL_REF)
+    if (pool->recording != NULL)
     {
-        Node* current = top;
+        flushRecording(pool);
+        fclose(pool->recording);
+        free(pool->recordedCalls);
 
-        while (current != NULL_REF)
-        {
-            assert(current != NULL_REF);
+        pool->recording = NULL;
+        pool->recordedCalls = NULL;
+    }
 
-            bytesUsed += current->ref.size;
+    if (path != NULL)
+    {
+        FILE* file = fopen(path, "wb");
+        PoolSetup setup;
 
-            if (current->ref.count > 0)
-            {
-                memcpy(&temp[newFreePtr], &buffer[current->ref.address], current->ref.size);
+        memset(&setup, 0, sizeof(PoolSetup));
+        setup.size = pool->size;
+        setup.maximumSize = pool->reserved;
+        setup.nurseryBytes = pool->nursery.end - pool->nursery.start;
+        setup.promotionAge = pool->promotionAge;
+        setup.pauseBudget = pool->pauseBudget;
+        setup.largeObjectSize = pool->largeObjectSize;
+        setup.alignment = pool->alignment;
+        setup.tracing = pool->tracing;
 
-                current->ref.address = newFreePtr;
-                newFreePtr += current->ref.size;
+        pool->recordedCalls = (PoolCall*) malloc(RECORDING_BUFFER_CALLS * sizeof(PoolCall));
 
-                newTop = createNode(current->ref, newTop);
-                assert(newTop != NULL_REF);
-            }
-            else
-            {
-                bytesCollected += current->ref.size;
-            }
-            
-            current = current->next; 
+        if (file != NULL && pool->recordedCalls != NULL
+            && fwrite(RECORDING_MAGIC, 1, RECORDING_MAGIC_SIZE, file) == RECORDING_MAGIC_SIZE
+            && fwrite(&setup, sizeof(PoolSetup), 1, file) == 1)
+        {
+            clock_gettime(CLOCK_MONOTONIC, &pool->recordingStarted);
+            pool->recordedCount = 0;
+            pool->recording = file;
         }
-
-        current = top;
-
-        Node* tempNode = NULL_REF;
-
-        while (current != NULL_REF)
+        else
         {
-            assert(current != NULL_REF);
-            
-            tempNode = current->next;
+            fprintf(stdout, "Could not start recording the pool to '%s'.\n", path);
 
-            free(current);
-
-            current = tempNode;
+            if (file != NULL) fclose(file);
+            free(pool->recordedCalls);
+            pool->recordedCalls = NULL;
+            result = 0;
         }
-
-        free(buffer); 
-        buffer = temp;
-        freePtr = newFreePtr;
-        top = newTop;
-    }
-    else
-    {
-        fprintf(stdout, "Failed to dynamically allocate buffer for compation\n");
     }
 
-    verifyState();
-    
-    fprintf(stdout, "\nGARBAGE COLLECTION STATS\n");
-    fprintf(stdout, "-----------------------\n");
-    fprintf(stdout, "Total objects: %lu\n", totalObjects);
-    fprintf(stdout, "Total number of bytes used: %d\n", bytesUsed);
-    fprintf(stdout, "Total number of bytes collected: %d\n", bytesCollected);
-    fprintf(stdout, "-----------------------\n");
+    return result;
 }
 
 //------------------------------------------------------
-// insertOjbect
+// poolDump
 //
-// PURPOSE: Attemps to insert an object into the pool
+// PURPOSE: Used for debugging the object manager by printing information about the pool.
+// Safe to call while holding access to the pool.
 // INPUT PARAMETERS:
-// size - The size of the object that is being inserted into the
-// object pool.
-// OUTPUT PARAMETERS:
-// Either the reference that was inserted into the pool or NULL_REF
-// if we could not allocate memory for the object.
+// pool - The pool being printed
 //------------------------------------------------------
-Ref insertObject( const int size )
+void poolDump( ObjectPool *pool )
 {
-    verifyState();
-    Ref id = NULL_REF;
+    int empty = 1;
 
-    assert(size >= 0);
-
-    if (size >= 0)
+    fprintf(stdout, "\nOBJECT POOL DUMP\n");
+    fprintf(stdout, "-----------------------\n");
+    if (pool != NULL_REF)
     {
-        assert(size <= MEMORY_SIZE);
+        unsigned long index;
 
-        if (size <= MEMORY_SIZE)
-        {
-            // Try to compact the pool
-            if((freePtr + size) >= MEMORY_SIZE)
-            {
-                compact();
-            }
-            
-            if ((freePtr + size) <= MEMORY_SIZE)
-            {
-                Reference ref = createReference(size, freePtr, (++references), 1);
+        beginInspection(pool);
 
-                // Now insert the Reference to the top of the linked list.
-                Node* node = createNode(ref, top);
+        for (index = nextSlot(pool, 1, USED_SLOTS); index < pool->handlesUsed; index = nextSlot(pool, index + 1, USED_SLOTS))
+        {
+            Handle* current = HANDLE_AT(pool, index);
 
-                if (node != NULL_REF)
+            if (current->inUse)
+            {
+                // we store size in bytes
+                if (current->large != NULL_REF)
                 {
-                    totalObjects++;
-
-                    freePtr += size;
-
-                    top = node;
-
-                    id = ref.id;
+                    fprintf(stdout, "Reference(id=%lu, large, size=%d, count=%d)\n", current->ref.id, current->ref.size, __atomic_load_n(&current->ref.count, __ATOMIC_RELAXED));
                 }
                 else
                 {
-                    references--;
-                    fprintf(stdout, "Could not insert node into top of linked list\n");
+                    fprintf(stdout, "Reference(id=%lu, address=%d, size=%d, count=%d)\n", current->ref.id, current->ref.address, current->ref.size, __atomic_load_n(&current->ref.count, __ATOMIC_RELAXED));
                 }
-
-                assert(top != NULL_REF);
-            }
-            else
-            {
-                fprintf(stdout, "After compaction object pool is full cannot insert object of size %d.\n", size);
+                empty = 0;
             }
         }
-        else
-        {
-            fprintf(stdout, "object exceddes memory size.\n");
-        }
+
+        endInspection(pool);
     }
-    else
+
+    if (empty)
     {
-        fprintf(stdout, "size of inserted object is negative and is required to be k >= 0.\n");
+        fprintf(stdout, "Empty object pool\n");
     }
-
-    return id;
+    fprintf(stdout, "-----------------------\n");
 }
 
+//-------------------------------------------------------------------------------------
+// TRACE EXPORT
+//-------------------------------------------------------------------------------------
+
 //------------------------------------------------------
-// retrieveObject
+// createTraceBuffer
 //
-// PURPOSE: Looks up an object in our pool to return the
-// address of the pointer.
+// PURPOSE: Creates a buffer that keeps the last events of a pool once
+// it is set as the context of recordTraceEvent.
 // INPUT PARAMETERS:
-// ref - The id we are looking for to find the value in.
+// events - The number of events kept, older ones are overwritten
 // OUTPUT PARAMETERS:
-// Either a pointer to the object or NULL_REF
+// The buffer, or NULL if there is no memory for it.
 //------------------------------------------------------
-void *retrieveObject( const Ref ref )
+TraceBuffer *createTraceBuffer( int events )
 {
-    verifyState();
-    unsigned char * object = NULL_REF;
+    TraceBuffer* trace = NULL;
 
-    assert(ref > 0);
+    assert(events > 0);
 
-    if (ref > 0)
+    if (events > 0)
     {
-        Node* current = top;
-            
-        while (current != NULL_REF && current->ref.id != ref)
-        {
-            current = current->next;
-        }
-        
-        if (current != NULL_REF)
+        trace = (TraceBuffer*) calloc(1, sizeof(TraceBuffer));
+
+        if (trace != NULL)
         {
-            assert(current->ref.address >= 0 && current->ref.address < MEMORY_SIZE);
-        
-            assert(buffer != NULL_REF);
+            trace->records = (TraceRecord*) malloc((size_t) events * sizeof(TraceRecord));
+            trace->capacity = (unsigned long) events;
+            pthread_mutex_init(&trace->lock, NULL);
 
-            if (buffer != NULL_REF && current->ref.address >= 0 && current->ref.address < MEMORY_SIZE)
+            if (trace->records == NULL)
             {
-                object = (unsigned char *) &buffer[current->ref.address];
+                fprintf(stdout, "Failed to allocate a trace buffer of %d events.\n", events);
 
-                assert(object != NULL_REF);
-            }
-            else
-            {
-                fprintf(stdout, "Current buffer is null. Is the object pool initalized\n");
+                deleteTraceBuffer(trace);
+                trace = NULL;
             }
         }
-        else
-        {
-            fprintf(stdout, "Could not find reference with id of '%lu'.\n", ref);
-        }
     }
     else
     {
-        fprintf(stdout, "Reference id must be greater than zero current '%lu'.\n", ref);
-    }   
+        fprintf(stdout, "A trace buffer needs room for at least one event.\n");
+    }
 
-    return object;
+    return trace;
 }
 
 //------------------------------------------------------
-// addReference
+// deleteTraceBuffer
 //
-// PURPOSE: Increments a refernce that is in the pool
+// PURPOSE: Frees a trace buffer. No pool may still report to it.
 // INPUT PARAMETERS:
-// ref the refernce that is being incremented
+// trace - The buffer being freed
 //------------------------------------------------------
-void addReference( const Ref ref )
+void deleteTraceBuffer( TraceBuffer *trace )
+{
+    if (trace != NULL)
+    {
+        pthread_mutex_destroy(&trace->lock);
+        free(trace->records);
+        free(trace);
+    }
+}
+
+//------------------------------------------------------
+// currentTraceThread
+//
+// PURPOSE: The id the current thread goes by in traces, the one the
+// system knows it by where there is one, so the collections line up
+// with the thread's own spans.
+// OUTPUT PARAMETERS:
+// The id of the thread.
+//------------------------------------------------------
+static int currentTraceThread()
 {
-    verifyState();
+    if (traceThread == 0)
+    {
+#if defined(__linux__) && defined(SYS_gettid)
+        traceThread = (int) syscall(SYS_gettid);
+#else
+        static int nextTraceThread = 0;
 
-    assert(ref > 0);
+        traceThread = __atomic_add_fetch(&nextTraceThread, 1, __ATOMIC_RELAXED);
+#endif
+    }
 
-    if (ref > 0)
+    return traceThread;
+}
+
+//------------------------------------------------------
+// recordTraceEvent
+//
+// PURPOSE: An event hook that keeps every event of a pool in the trace
+// buffer given as its context, with the thread it happened on.
+// INPUT PARAMETERS:
+// event - The event being kept
+// context - The trace buffer
+//------------------------------------------------------
+void recordTraceEvent( const GcEvent *event, void *context )
+{
+    TraceBuffer* trace = (TraceBuffer*) context;
+    int thread = currentTraceThread();
+
+    pthread_mutex_lock(&trace->lock);
+
+    trace->records[trace->recorded % trace->capacity].event = *event;
+    trace->records[trace->recorded % trace->capacity].thread = thread;
+    trace->recorded++;
+
+    pthread_mutex_unlock(&trace->lock);
+}
+
+//------------------------------------------------------
+// findTraceThread
+//
+// PURPOSE: Finds the open collections of a thread while a trace is
+// written out, adding the thread the first time it shows up.
+// INPUT PARAMETERS:
+// threads - The threads seen so far, grown as needed
+// count - The number of threads seen so far
+// capacity - The room in threads
+// thread - The thread being looked for
+// OUTPUT PARAMETERS:
+// The entry of the thread, or NULL if there is no memory for it.
+//------------------------------------------------------
+static TraceThread *findTraceThread(TraceThread **threads, int *count, int *capacity, const int thread)
+{
+    TraceThread* found = NULL;
+    int i;
+
+    for (i = 0; i < *count && found == NULL; i++)
     {
-        Node* current = top;
-            
-        while (current != NULL_REF && current->ref.id != ref)
+        if ((*threads)[i].thread == thread)
         {
-            current = current->next;
+            found = &(*threads)[i];
         }
-        
-        assert(current != NULL_REF);
+    }
 
-        if (current != NULL_REF)
+    if (found == NULL)
+    {
+        if (*count == *capacity)
         {
-            current->ref.count++;
+            int grown = *capacity == 0 ? 16 : *capacity * 2;
+            TraceThread* more = (TraceThread*) realloc(*threads, grown * sizeof(TraceThread));
+
+            if (more != NULL)
+            {
+                *threads = more;
+                *capacity = grown;
+            }
         }
-        else
+
+        if (*count < *capacity)
         {
-            fprintf(stdout, "Could not find reference with id of '%lu'.\n", ref);
+            found = &(*threads)[(*count)++];
+            memset(found, 0, sizeof(TraceThread));
+            found->thread = thread;
         }
     }
-    else
-    {
-        fprintf(stdout, "Reference id must be greater than zero current '%lu'.\n", ref);
-    }    
+
+    return found;
 }
 
 //------------------------------------------------------
-// dropReference
+// writeTraceBuffer
 //
-// PURPOSE: Reduces the amount of refernces to an object in the pool
-// used during the compaction to free the memory. 
+// PURPOSE: Writes the events kept by a trace buffer as Chrome trace-event
+// JSON, for chrome://tracing or Perfetto. Timestamps are microseconds
+// on CLOCK_MONOTONIC, so they line up with spans the application takes
+// from the same clock. The oldest events may have been overwritten,
+// so the end of a collection whose begin is gone is left out, and a
+// collection still open at the end is closed at the last event.
 // INPUT PARAMETERS:
-// ref - The refece that is being decremented from the pool
+// trace - The buffer being written
+// path - The file the trace is written to
+// OUTPUT PARAMETERS:
+// The number of events written, or -1 if the file could not be opened.
 //------------------------------------------------------
-void dropReference( const Ref ref )
+long writeTraceBuffer( TraceBuffer *trace, const char *path )
 {
-    verifyState();
-
-    assert(ref > 0);
+    long written = -1;
+    FILE* out = fopen(path, "w");
 
-    if (ref > 0)
+    if (out == NULL)
+    {
+        fprintf(stdout, "Could not open '%s' for writing.\n", path);
+    }
+    else
     {
-        Node* current = top;
+        TraceThread* threads = NULL;
+        int threadCount = 0;
+        int threadCapacity = 0;
+        unsigned long last = 0;
+        unsigned long first;
+        unsigned long i;
+        int pid = (int) getpid();
+        int t;
 
-        while (current != NULL_REF && current->ref.id != ref)
-        {
-            current = current->next;
-        }
+        written = 0;
 
-        assert(current != NULL_REF);
-        
-        if (current != NULL_REF)
+        pthread_mutex_lock(&trace->lock);
+
+        first = trace->recorded > trace->capacity ? trace->recorded - trace->capacity : 0;
+
+        fprintf(out, "{\"traceEvents\":[\n");
+
+        for (i = first; i < trace->recorded; i++)
         {
-            current->ref.count--;
+            const TraceRecord* record = &trace->records[i % trace->capacity];
+            const GcEvent* event = &record->event;
+            TraceThread* thread = findTraceThread(&threads, &threadCount, &threadCapacity, record->thread);
+            const char* kind = event->kind != NULL ? event->kind : "collection";
+
+            // an end whose begin was overwritten, or a pair that could not be matched up
+            if ((event->type == GC_EVENT_BEGIN || event->type == GC_EVENT_END)
+                && (thread == NULL || (event->type == GC_EVENT_END && thread->depth == 0)))
+            {
+                continue;
+            }
+
+            fprintf(out, "%s{\"pid\":%d,\"tid\":%d,\"ts\":%lu.%03lu,", written == 0 ? "" : ",\n",
+                pid, record->thread, event->timestamp / 1000, event->timestamp % 1000);
+
+            switch (event->type)
+            {
+                case GC_EVENT_BEGIN:
+                    fprintf(out, "\"ph\":\"B\",\"cat\":\"gc\",\"name\":\"%s\"}", kind);
+
+                    if (thread->depth < TRACE_DEPTH)
+                    {
+                        thread->open[thread->depth] = kind;
+                    }
+
+                    thread->depth++;
+                    break;
+
+                case GC_EVENT_END:
+                    fprintf(out, "\"ph\":\"E\",\"cat\":\"gc\",\"name\":\"%s\"}", kind);
+                    thread->depth--;
+                    break;
+
+                case GC_EVENT_MOVE:
+                    fprintf(out, "\"ph\":\"i\",\"s\":\"t\",\"cat\":\"gc.move\",\"name\":\"move\","
+                        "\"args\":{\"ref\":%lu,\"from\":%ld,\"to\":%ld,\"bytes\":%ld}}",
+                        event->ref, event->from, event->to, event->bytes);
+                    break;
+
+                case GC_EVENT_ALLOCATION_FAILURE:
+                    fprintf(out, "\"ph\":\"i\",\"s\":\"p\",\"cat\":\"gc\",\"name\":\"allocation failure\","
+                        "\"args\":{\"bytes\":%ld}}", event->bytes);
+                    break;
+
+                default:
+                    fprintf(out, "\"ph\":\"C\",\"cat\":\"gc\",\"name\":\"pool size\",\"args\":{\"bytes\":%ld}}", event->bytes);
+                    break;
+            }
+
+            last = event->timestamp;
+            written++;
         }
-        else
+
+        // close what the last events left open, innermost first
+        for (t = 0; t < threadCount; t++)
         {
-            fprintf(stdout, "Could not find reference with id of '%lu'.\n", ref);
+            while (threads[t].depth > 0)
+            {
+                threads[t].depth--;
+
+                fprintf(out, "%s{\"pid\":%d,\"tid\":%d,\"ts\":%lu.%03lu,\"ph\":\"E\",\"cat\":\"gc\",\"name\":\"%s\"}",
+                    written == 0 ? "" : ",\n", pid, threads[t].thread, last / 1000, last % 1000,
+                    threads[t].depth < TRACE_DEPTH ? threads[t].open[threads[t].depth] : "collection");
+                written++;
+            }
         }
+
+        fprintf(out, "\n]}\n");
+
+        pthread_mutex_unlock(&trace->lock);
+
+        free(threads);
+        fclose(out);
     }
-    else
-    {
-        fprintf(stdout, "Reference id must be greater than zero current '%lu'.\n", ref);
-    }   
+
+    return written;
 }
 
+//-------------------------------------------------------------------------------------
+// DEFAULT POOL
+//-------------------------------------------------------------------------------------
+
 //------------------------------------------------------
-// myRoutine
+// getDefaultPool
 //
-// PURPOSE: Initalizes the object pool with the assigned amount of memory.
+// PURPOSE: Gives access to the pool used by the functions that do
+// not take one.
+// OUTPUT PARAMETERS:
+// The default pool or NULL if initPool has not been called.
 //------------------------------------------------------
-void initPool() 
+ObjectPool *getDefaultPool()
 {
-    // this is an edge case with clang++ were we must cast to the type
-    buffer = (unsigned char *)  malloc(MEMORY_SIZE * sizeof(unsigned char));
+    return defaultPool;
+}
 
-    assert(buffer != NULL_REF);
+Ref insertObject( const int size )
+{
+    return poolInsertObject(defaultPool, size);
+}
 
-    if (buffer == NULL_REF)
-    {
-        fprintf(stdout, "Failed to dynnamically allocate memory for object pool.\n");
-    }
+void *retrieveObject( const Ref ref )
+{
+    return poolRetrieveObject(defaultPool, ref);
 }
 
-//------------------------------------------------------
-// destroyPool()
-//
-// PURPOSE: Removes all information that is stored with-in the pool.
-//------------------------------------------------------
-void destroyPool()
+void addReference( const Ref ref )
 {
-    // To clean up we must reference the linked list and the two buffers.
-    Node* current = top;
-    Node* temp = NULL_REF;
+    poolAddReference(defaultPool, ref);
+}
 
-    while (current != NULL_REF)
-    {
-        temp = current->next;
+void dropReference( const Ref ref )
+{
+    poolDropReference(defaultPool, ref);
+}
 
-        free(current);
+void *pinObject( const Ref ref )
+{
+    return poolPinObject(defaultPool, ref);
+}
 
-        current = temp;
-    }
+void unpinObject( const Ref ref )
+{
+    poolUnpinObject(defaultPool, ref);
+}
+
+Ref insertTracedObject( const int size, const int slots )
+{
+    return poolInsertTracedObject(defaultPool, size, slots);
+}
+
+Ref insertObjectAligned( const int size, const int alignment )
+{
+    return poolInsertAlignedObject(defaultPool, size, alignment);
+}
 
-    if(buffer != NULL_REF) free(buffer);
+int insertObjects( const int *sizes, Ref *out, const int n )
+{
+    return poolInsertObjects(defaultPool, sizes, out, n);
+}
+
+void addReferences( const Ref *refs, const int n )
+{
+    poolAddReferences(defaultPool, refs, n);
+}
+
+void dropReferences( const Ref *refs, const int n )
+{
+    poolDropReferences(defaultPool, refs, n);
+}
 
-    freePtr = 0;
-    references = 0;
-    totalObjects = 0;
+void getPoolStats( PoolStats *stats )
+{
+    poolGetStats(defaultPool, stats);
+}
 
-    buffer = NULL_REF;
-    top = NULL_REF;
+int collectStep( long budgetMicros )
+{
+    return poolCollectStep(defaultPool, budgetMicros);
+}
 
-    assert(buffer == NULL);
-    assert(top == NULL);
-    assert(freePtr == 0);
-    assert(references == 0);
-    assert(totalObjects == 0);
+//------------------------------------------------------
+// initPool
+//
+// PURPOSE: Initalizes the default object pool with the assigned amount of memory.
+// Initializing a pool that already exists keeps the existing pool.
+//------------------------------------------------------
+void initPool()
+{
+    initPoolSized(MEMORY_SIZE, MEMORY_SIZE);
 }
 
 //------------------------------------------------------
-// dumpPool
+// initPoolSized
 //
-// PURPOSE: Used for debugging the object manager by printing information about the pool
+// PURPOSE: Initalizes the default object pool with a size chosen at
+// runtime, letting it grow up to the given maximum.
+// Initializing a pool that already exists keeps the existing pool.
+// INPUT PARAMETERS:
+// initialBytes - The number of bytes the pool manages to begin with
+// maximumBytes - The number of bytes the pool can grow to
 //------------------------------------------------------
-void dumpPool()
+void initPoolSized( size_t initialBytes, size_t maximumBytes )
 {
-    fprintf(stdout, "\nOBJECT POOL DUMP\n");
-    fprintf(stdout, "-----------------------\n");
-    if (top == NULL_REF)
+    if (defaultPool == NULL_REF)
     {
-        fprintf(stdout, "Empty object pool\n");
+        defaultPool = createGrowablePool(initialBytes, maximumBytes);
     }
-    else
-    {
-        Node* current = top;
+}
 
-        while (current != NULL_REF)
-        {
-            // we store size in bytes
-            // not sure if the address is right
-            fprintf(stdout, "Reference(id=%lu, address=%d, size=%d, count=%d)\n", current->ref.id, current->ref.address, current->ref.size, current->ref.count);
+//------------------------------------------------------
+// destroyPool()
+//
+// PURPOSE: Removes all information that is stored with-in the default pool.
+//------------------------------------------------------
+void destroyPool()
+{
+    deletePool(defaultPool);
 
-            current = current->next;
-        }
-    }
-    fprintf(stdout, "-----------------------\n");
-}
\ No newline at end of file
+    defaultPool = NULL_REF;
+
+    assert(defaultPool == NULL);
+}
+
+void dumpPool()
+{
+    poolDump(defaultPool);
+}
@@ -1,15 +1,162 @@
 #ifndef _OBJECT_MANAGER_H
 #define _OBJECT_MANAGER_H
 
+#include <stddef.h>
+
 // The number of bytes of memory we have access to -- put here so everyone's consistent.
 #ifndef MEMORY_SIZE
 #define MEMORY_SIZE 1024*512
 #endif
 
+// Every object in a pool takes OBJECT_HEADER_SIZE bytes more than its size, which is rounded up
+// to a multiple of OBJECT_GRANULE. So a pool of MEMORY_SIZE bytes holds one object of at most
+// MEMORY_SIZE - OBJECT_HEADER_SIZE bytes, and fewer bytes of many small objects than its size.
+#define OBJECT_HEADER_SIZE 8
+#define OBJECT_GRANULE 8
+
 #define NULL_REF 0
 
 typedef unsigned long Ref;
 
+// Bucket 0 of the pause histogram counts pauses under a microsecond, bucket i those under
+// 2^i microseconds, and the last bucket everything longer.
+#define PAUSE_BUCKETS 24
+
+typedef struct POOL_STATS PoolStats;
+
+// The events a pool reports to its hook, see setPoolEventHook.
+#define GC_EVENT_BEGIN 0
+#define GC_EVENT_END 1
+#define GC_EVENT_MOVE 2
+#define GC_EVENT_ALLOCATION_FAILURE 3
+#define GC_EVENT_GROW 4
+
+typedef struct GC_EVENT GcEvent;
+
+struct GC_EVENT
+{
+    // one of the GC_EVENT_ values
+    int type;
+
+    // nanoseconds on CLOCK_MONOTONIC
+    unsigned long timestamp;
+
+    // the kind of collection a begin or end event is about, NULL otherwise
+    const char *kind;
+
+    // the object that moved, with the offsets it moved from and to
+    Ref ref;
+    long from;
+    long to;
+
+    // the size of the moved object or failed insert, or the new size of a grown pool
+    long bytes;
+};
+
+typedef void (*GcEventHook)( const GcEvent *event, void *context );
+
+typedef struct TRACE_BUFFER TraceBuffer;
+
+// A recording of the calls made on a pool, see setPoolRecording, starts with the
+// RECORDING_MAGIC_SIZE bytes of RECORDING_MAGIC and a PoolSetup, followed by one PoolCall
+// per call.
+#define RECORDING_MAGIC "OMREC003"
+#define RECORDING_MAGIC_SIZE 8
+
+typedef struct POOL_SETUP PoolSetup;
+
+// How a recorded pool was set up when the recording started.
+struct POOL_SETUP
+{
+    // the bytes the pool had and the bytes it could grow to
+    long size;
+    long maximumSize;
+
+    // the nursery of a generational pool, 0 bytes if it has none, see setPoolGenerational
+    long nurseryBytes;
+    int promotionAge;
+
+    // see setPoolPauseBudget, setPoolLargeObjectSize, setPoolAlignment and setPoolTracing
+    long pauseBudget;
+    int largeObjectSize;
+    int alignment;
+    int tracing;
+};
+
+#define POOL_CALL_INSERT 0
+#define POOL_CALL_ADD_REFERENCE 1
+#define POOL_CALL_DROP_REFERENCE 2
+#define POOL_CALL_PIN 3
+#define POOL_CALL_UNPIN 4
+#define POOL_CALL_COLLECT_STEP 5
+#define POOL_CALL_INSERT_ALIGNED 6
+#define POOL_CALL_SET_ALIGNMENT 7
+#define POOL_CALL_INSERT_TRACED 8
+#define POOL_CALL_SET_TRACING 9
+
+typedef struct POOL_CALL PoolCall;
+
+struct POOL_CALL
+{
+    // nanoseconds since the recording started
+    unsigned long timestamp;
+
+    // the object the call was about, or the one an insert returned (NULL_REF if it failed)
+    Ref ref;
+
+    // the size of an insert, the budget of a collection step, the new default alignment or
+    // whether tracing was turned on
+    int value;
+
+    // one of the POOL_CALL_ values
+    int call;
+
+    // the alignment of an aligned insert, the slots of a traced insert, 0 for other calls
+    int detail;
+};
+
+// The counters a pool keeps about its collections, see getPoolStats.
+struct POOL_STATS
+{
+    // collections of any kind, and how many of them only collected the nursery
+    unsigned long collections;
+    unsigned long minorCollections;
+
+    // totals over every collection so far
+    unsigned long bytesMoved;
+    unsigned long bytesReclaimed;
+    unsigned long bytesReleased;
+
+    // what the last collection did
+    unsigned long lastBytesMoved;
+    unsigned long lastBytesReclaimed;
+    unsigned long lastPauseNanos;
+
+    // inserts that failed because the pool was full even after collecting
+    unsigned long allocationFailures;
+
+    // the objects the collector keeps right now and the bytes they hold: those with references,
+    // or in a tracing pool those its last trace reached and those inserted since
+    unsigned long liveObjects;
+    unsigned long liveBytes;
+
+    // the objects of those in the large-object space and the bytes of the pages mapped for them
+    unsigned long largeObjects;
+    unsigned long largeBytes;
+
+    // the share of free bytes that are scattered between objects rather than in one piece
+    double fragmentation;
+
+    // how long collections held the pool
+    unsigned long totalPauseNanos;
+    unsigned long maxPauseNanos;
+    unsigned long pauseHistogram[PAUSE_BUCKETS];
+};
+
+// An independent object pool. Each pool has its own memory, index and collector,
+// so collecting one pool never pauses work in another.
+typedef struct OBJECT_POOL ObjectPool;
+
 // Note that we provide our entire interface via this object module and completely hide our index (see course notes).
 // This allows us to change indexing strategies without affecting the interface to everyone else.
 
@@ -17,21 +164,61 @@ typedef unsigned long Ref;
 // It will fire the garbage collector as required.
 // We always assume that an insert always creates a new object...
 // On success it returns the reference number for the block of memory allocated for the object.
-// On failure it returns NULL_REF (0)
+// On failure it returns NULL_REF (0), straight away without collecting if the object could not
+// fit even an empty pool, header and rounding included (see OBJECT_HEADER_SIZE).
 Ref insertObject( const int size );
 
 // returns a pointer to the object being requested given by the reference id
+// (NULL if the reference is unknown or its object has already been collected)
 void *retrieveObject( const Ref ref );
 
 // update our index to indicate that we have another reference to the given object
 void addReference( const Ref ref );
 
-// update our index to indicate that a reference is gone
+// update our index to indicate that a reference is gone, the object is freed along with
+// its last reference. In a concurrent pool the free is queued with the thread's shard, and
+// the object can still be retrieved until the queue is flushed, once it fills up, when the
+// thread takes a new chunk or at the next collection. Don't rely on it.
 void dropReference( const Ref ref );
 
+// The batch versions of the three functions above, for callers that create or release many
+// objects at once. A batch insert collects for the whole batch at once rather than partway
+// through: one full collection, or in a generational pool a minor collection followed by a
+// full one when emptying the nursery does not make room. out receives a reference per size
+// (NULL_REF for any that did not fit) and the number inserted is returned.
+int insertObjects( const int *sizes, Ref *out, const int n );
+void addReferences( const Ref *refs, const int n );
+void dropReferences( const Ref *refs, const int n );
+
+// Keep an object from being moved by the collector, so the returned pointer stays valid
+// until the matching unpinObject, across inserts and collections and without an access
+// section. Pins nest. Compaction works around pinned objects, so unpin them promptly.
+void *pinObject( const Ref ref );
+void unpinObject( const Ref ref );
+
+// Insert an object whose first slots words are Refs to other objects, all NULL_REF to begin
+// with. In a tracing pool the collector follows them, see setPoolTracing.
+Ref insertTracedObject( const int size, const int slots );
+
+// Insert an object that starts on a multiple of alignment bytes, a power of two of up to 4096.
+// The collector keeps it aligned whenever it moves it. Below 8 every object is aligned anyway.
+Ref insertObjectAligned( const int size, const int alignment );
+
+// fill in the counters of the pool, cumulative and for the last collection
+void getPoolStats( PoolStats *stats );
+
+// compact the pool for at most the given number of microseconds (0 to finish the job),
+// carrying on from where the last step stopped. Returns 1 while there is work left.
+int collectStep( long budgetMicros );
+
 // initialize the object manager
 void initPool();
 
+// initialize the object manager with a size chosen at runtime instead of MEMORY_SIZE. The pool
+// starts with initialBytes and grows in place, without moving objects, up to maximumBytes
+// when collecting does not free enough room.
+void initPoolSized( size_t initialBytes, size_t maximumBytes );
+
 // clean up the object manager (before exiting)
 void destroyPool();
 
@@ -39,4 +226,139 @@ void destroyPool();
 // You should print the block's reference id, it's starting address, and it's size (in bytes).
 void dumpPool();
 
+// The functions above all work on a default pool created by initPool. The functions below
+// do the same work on a pool given by the caller, so every subsystem or thread can own a pool.
+// A Ref is only meaningful to the pool that handed it out.
+
+// create an empty pool managing the given number of bytes, returns NULL on failure
+ObjectPool *createPool( size_t bytes );
+
+// create an empty pool managing initialBytes that grows in place up to maximumBytes,
+// address space for the maximum is reserved up front and memory committed as it grows
+ObjectPool *createGrowablePool( size_t initialBytes, size_t maximumBytes );
+
+// release a pool and every object in it
+void deletePool( ObjectPool *pool );
+
+// the pool used by the functions that don't take one (NULL before initPool)
+ObjectPool *getDefaultPool();
+
+// Make a pool safe to share between threads. Reference counts are then updated atomically,
+// lookups take no lock, and only a collection needs the pool to itself. Call this before
+// the pool is handed to other threads.
+void setPoolConcurrent( ObjectPool *pool, int enabled );
+
+// After a compaction the pool hands the pages above its live data back to the system, keeping
+// the given number of free bytes resident (1 MiB by default) so RSS follows the live data.
+void setPoolRetainBytes( ObjectPool *pool, size_t bytes );
+
+// Ask for transparent huge pages to back the pool, which cuts TLB misses on large pools.
+void setPoolHugePages( ObjectPool *pool, int enabled );
+
+// Collect a concurrent pool on a thread of its own. It empties the nursery before inserts
+// find it full and runs the compaction steps set up by setPoolPauseBudget, so inserting
+// threads only wait for one step at a time. An insert that finds the pool full anyway still
+// collects on its own thread. Call this before the pool is shared; deletePool stops it.
+void setPoolBackgroundCollection( ObjectPool *pool, int enabled );
+
+// Give an empty pool a nursery of the given size for new objects. Nursery collections only
+// touch young objects, and objects surviving promotionAge of them move to the old space for
+// good. A nursery of 0 bytes makes the pool a single space again.
+void setPoolGenerational( ObjectPool *pool, size_t nurseryBytes, int promotionAge );
+
+// Cap how long one compaction step may pause the pool. Once the pool fills up, every insert
+// runs one step of at most budgetMicros until the compaction is done, instead of a single
+// insert compacting the whole pool when it runs out of room. 0 (the default) turns this off.
+void setPoolPauseBudget( ObjectPool *pool, long budgetMicros );
+
+// Decide what the collector keeps by tracing instead of by counts. The roots are the objects
+// with references or pins, and from them the collector follows the reference slots of objects
+// made by poolInsertTracedObject. What it cannot reach is reclaimed, cycles included, so
+// dropping the last reference no longer frees an object straight away. Set it on an empty pool.
+// In a generational pool a minor collection traces only the nursery, from its own roots and from
+// the old objects remembered as possibly pointing into it: those whose pointer was handed out by
+// retrieveObject or pinObject since the last collection, or that still point into the nursery.
+// So write slots only through such a pointer, which the rules for pointers already ask for.
+void setPoolTracing( ObjectPool *pool, int enabled );
+
+// Count how often every object is retrieved, and have full compactions (collections that run
+// out of room and poolCollectStep with no budget) move the objects retrieved at least a few times
+// since the last one to the top of the old space, next to each other. Everything else keeps
+// its allocation order, as it does without grouping. Off by default.
+void setPoolHotGrouping( ObjectPool *pool, int enabled );
+
+// Scan the bitmaps kept next to the handle table with AVX2 or AVX-512 vectors when the
+// processor has them, whatever flags the library was built with. On by default, turning it off
+// is for comparing. Set it before the pool is shared. Returns how many bitmap words a scan now
+// skips at once: 8, 4 or 1.
+int setPoolVectorScans( ObjectPool *pool, int enabled );
+
+// Put objects of at least bytes into the large-object space, each in page aligned pages mapped
+// for it alone. They are never copied by a collection and are not limited by the size of the
+// pool. Their pages are unmapped when the last reference is dropped, or in a tracing pool by
+// the next full collection that finds them unreachable. 0 (the default) keeps every object in
+// the pool. Set it before the pool is shared.
+void setPoolLargeObjectSize( ObjectPool *pool, int bytes );
+
+// Align every object inserted without an alignment of its own, batches included, on a multiple
+// of alignment bytes, see insertObjectAligned. 8 by default.
+void setPoolAlignment( ObjectPool *pool, int alignment );
+
+// Collect with this many threads, the collecting thread and threads-1 helpers. They mark a
+// tracing pool, stealing work from each other, and share the sliding of a full compaction
+// region by region. Small pools are still collected by one thread, as are compactions of pools
+// with pinned objects. 1 (the default) stops the helpers. Set it while no collection is running.
+void setPoolGcThreads( ObjectPool *pool, int threads );
+
+// A pointer from retrieveObject is only good until the next collection, and in a concurrent
+// pool any thread can trigger one. Pointers taken between these two calls stay valid until
+// endPoolAccess. An insert made while holding access never collects, it fails instead when
+// the pool is full. Keep these sections short, a pending collection waits for them.
+void beginPoolAccess( ObjectPool *pool );
+void endPoolAccess( ObjectPool *pool );
+
+Ref poolInsertObject( ObjectPool *pool, const int size );
+void *poolRetrieveObject( ObjectPool *pool, const Ref ref );
+void poolAddReference( ObjectPool *pool, const Ref ref );
+void poolDropReference( ObjectPool *pool, const Ref ref );
+void *poolPinObject( ObjectPool *pool, const Ref ref );
+void poolUnpinObject( ObjectPool *pool, const Ref ref );
+Ref poolInsertTracedObject( ObjectPool *pool, const int size, const int slots );
+Ref poolInsertAlignedObject( ObjectPool *pool, const int size, int alignment );
+int poolInsertObjects( ObjectPool *pool, const int *sizes, Ref *out, const int n );
+void poolAddReferences( ObjectPool *pool, const Ref *refs, const int n );
+void poolDropReferences( ObjectPool *pool, const Ref *refs, const int n );
+void poolDump( ObjectPool *pool );
+void poolGetStats( ObjectPool *pool, PoolStats *stats );
+
+// Print the stats of every collection to stdout, off by default.
+void setPoolVerbose( ObjectPool *pool, int enabled );
+
+// Call hook with every collection begin and end, object moved, failed insert and growth of the
+// pool. Collection events come from whichever thread collects, with the pool held, so the hook
+// must not call back into the pool. With more than one GC thread, objects moved by a parallel
+// compaction are reported by the GC threads at the same time. Set it before the pool is shared, NULL turns it off.
+void setPoolEventHook( ObjectPool *pool, GcEventHook hook, void *context );
+int poolCollectStep( ObjectPool *pool, long budgetMicros );
+
+// Write every insert, reference change, pin, change of the default alignment and collection
+// step made on the pool to the file at path so it can be replayed, NULL stops recording. The
+// file starts with how the pool is set up, so set it up before recording. Lookups change
+// nothing and are not recorded. Returns 0 if the file could not be opened. Call it while no
+// other thread is using the pool. A tracing pool is recorded, traced inserts with their slots,
+// but the stores into the slots are plain writes the pool never sees. So what keeps its objects
+// alive is not in the recording, and the replay tool refuses recordings of tracing pools.
+int setPoolRecording( ObjectPool *pool, const char *path );
+
+// Keep the last events of a pool to write them out as Chrome trace-event JSON, which opens in
+// chrome://tracing or Perfetto. Attach a buffer with setPoolEventHook(pool, recordTraceEvent,
+// trace), several pools may share one. Timestamps are microseconds on CLOCK_MONOTONIC and threads
+// go by their system ids, so collections line up with the application's own spans. A collection
+// whose begin was overwritten is left out, and one still under way is closed at the last event.
+// writeTraceBuffer returns the number of events written, or -1 if the file could not be opened.
+TraceBuffer *createTraceBuffer( int events );
+void recordTraceEvent( const GcEvent *event, void *context );
+long writeTraceBuffer( TraceBuffer *trace, const char *path );
+void deleteTraceBuffer( TraceBuffer *trace );
+
 #endif
@@ -0,0 +1,316 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "ObjectManager.h"
+#include "pauses.h"
+
+// Small enough that the churn and fragmentation workloads collect often.
+#define BENCH_POOL_SIZE (1024*1024)
+
+// Objects kept alive by the lookup and refcount workloads.
+#define LOOKUP_OBJECTS 4096
+
+// Objects kept alive by each ring of the churn workload, every
+// LONG_LIVED_EVERY-th object goes to the ring that turns over slower.
+#define CHURN_WINDOW 256
+#define LONG_LIVED_EVERY 16
+
+// Live objects in the fragmentation workload.
+#define FRAGMENT_OBJECTS 2048
+
+// Objects in the tree the mark workload traces over and over.
+#define MARK_OBJECTS 16384
+
+typedef struct BENCHMARK Benchmark;
+
+struct BENCHMARK
+{
+    const char *name;
+    void (*run)( ObjectPool *pool, const long operations );
+};
+
+static unsigned long randomState = 88172645463325252UL;
+
+// keeps the compiler from dropping the lookups
+static volatile unsigned long sink = 0;
+
+// threads collecting the pool of every workload
+static int gcThreads = 1;
+
+//------------------------------------------------------
+// nextRandom
+//
+// PURPOSE: A small xorshift generator, the same one stress.c uses.
+//------------------------------------------------------
+static unsigned long nextRandom()
+{
+    randomState ^= randomState << 13;
+    randomState ^= randomState >> 7;
+    randomState ^= randomState << 17;
+    return randomState;
+}
+
+//------------------------------------------------------
+// benchInsert
+//
+// PURPOSE: Inserts objects of one size in batches and drops each batch,
+// so the time goes to allocation rather than to collection.
+//------------------------------------------------------
+static void benchInsert(ObjectPool *pool, const long operations)
+{
+    Ref batch[LOOKUP_OBJECTS];
+
+    for (long done = 0; done < operations; done += LOOKUP_OBJECTS)
+    {
+        int n = operations - done < LOOKUP_OBJECTS ? (int) (operations - done) : LOOKUP_OBJECTS;
+
+        for (int i = 0; i < n; i++)
+        {
+            batch[i] = poolInsertObject(pool, 64);
+        }
+
+        poolDropReferences(pool, batch, n);
+    }
+}
+
+//------------------------------------------------------
+// benchLookup
+//
+// PURPOSE: Reads random objects out of a fixed live set.
+//------------------------------------------------------
+static void benchLookup(ObjectPool *pool, const long operations)
+{
+    Ref objects[LOOKUP_OBJECTS];
+    unsigned long sum = 0;
+
+    for (int i = 0; i < LOOKUP_OBJECTS; i++)
+    {
+        objects[i] = poolInsertObject(pool, 64);
+    }
+
+    for (long i = 0; i < operations; i++)
+    {
+        unsigned long* object = (unsigned long*) poolRetrieveObject(pool, objects[nextRandom() % LOOKUP_OBJECTS]);
+        sum += object[0];
+    }
+
+    sink = sum;
+    poolDropReferences(pool, objects, LOOKUP_OBJECTS);
+}
+
+//------------------------------------------------------
+// benchChurn
+//
+// PURPOSE: Mixes short lived objects with a few that outlive many
+// collections, like requests passing through a server.
+//------------------------------------------------------
+static void benchChurn(ObjectPool *pool, const long operations)
+{
+    Ref shortLived[CHURN_WINDOW];
+    Ref longLived[CHURN_WINDOW];
+
+    memset(shortLived, 0, sizeof(shortLived));
+    memset(longLived, 0, sizeof(longLived));
+
+    for (long i = 0; i < operations; i++)
+    {
+        // every LONG_LIVED_EVERY-th object goes to the slower ring
+        Ref* slot = i % LONG_LIVED_EVERY == 0
+            ? &longLived[(i / LONG_LIVED_EVERY) % CHURN_WINDOW]
+            : &shortLived[i % CHURN_WINDOW];
+
+        if (*slot != NULL_REF)
+        {
+            poolDropReference(pool, *slot);
+        }
+
+        *slot = poolInsertObject(pool, 16 + (int) (nextRandom() % 240));
+    }
+
+    for (int i = 0; i < CHURN_WINDOW; i++)
+    {
+        if (shortLived[i] != NULL_REF)
+        {
+            poolDropReference(pool, shortLived[i]);
+        }
+
+        if (longLived[i] != NULL_REF)
+        {
+            poolDropReference(pool, longLived[i]);
+        }
+    }
+}
+
+//------------------------------------------------------
+// benchFragmentation
+//
+// PURPOSE: Replaces random objects of a live set with ones of a very
+// different size, leaving holes the free lists can't always fill.
+//------------------------------------------------------
+static void benchFragmentation(ObjectPool *pool, const long operations)
+{
+    Ref objects[FRAGMENT_OBJECTS];
+
+    memset(objects, 0, sizeof(objects));
+
+    for (long i = 0; i < operations; i++)
+    {
+        int slot = (int) (nextRandom() % FRAGMENT_OBJECTS);
+        int size = nextRandom() % 4 == 0 ? 512 + (int) (nextRandom() % 1536) : 16 + (int) (nextRandom() % 48);
+
+        if (objects[slot] != NULL_REF)
+        {
+            poolDropReference(pool, objects[slot]);
+        }
+
+        objects[slot] = poolInsertObject(pool, size);
+    }
+
+    for (int i = 0; i < FRAGMENT_OBJECTS; i++)
+    {
+        if (objects[i] != NULL_REF)
+        {
+            poolDropReference(pool, objects[i]);
+        }
+    }
+}
+
+//------------------------------------------------------
+// benchRefcount
+//
+// PURPOSE: Adds and drops references to random objects of a fixed set.
+//------------------------------------------------------
+static void benchRefcount(ObjectPool *pool, const long operations)
+{
+    Ref objects[LOOKUP_OBJECTS];
+
+    for (int i = 0; i < LOOKUP_OBJECTS; i++)
+    {
+        objects[i] = poolInsertObject(pool, 64);
+    }
+
+    for (long i = 0; i < operations; i += 2)
+    {
+        Ref target = objects[nextRandom() % LOOKUP_OBJECTS];
+
+        poolAddReference(pool, target);
+        poolDropReference(pool, target);
+    }
+
+    poolDropReferences(pool, objects, LOOKUP_OBJECTS);
+}
+
+//------------------------------------------------------
+// benchMark
+//
+// PURPOSE: Builds a binary tree in a tracing pool and collects it until
+// the given number of objects have been marked.
+//------------------------------------------------------
+static void benchMark(ObjectPool *pool, const long operations)
+{
+    Ref tree[MARK_OBJECTS];
+
+    setPoolTracing(pool, 1);
+
+    for (int i = 0; i < MARK_OBJECTS; i++)
+    {
+        tree[i] = poolInsertTracedObject(pool, 24, 2);
+
+        // every object but the root hangs off its parent and is only reachable through it
+        if (i > 0)
+        {
+            ((Ref*) poolRetrieveObject(pool, tree[(i - 1) / 2]))[(i - 1) % 2] = tree[i];
+            poolDropReference(pool, tree[i]);
+        }
+    }
+
+    for (long marked = 0; marked < operations; marked += MARK_OBJECTS)
+    {
+        poolCollectStep(pool, 0);
+    }
+
+    poolDropReference(pool, tree[0]);
+}
+
+static const Benchmark benchmarks[] =
+{
+    { "insert", benchInsert },
+    { "lookup", benchLookup },
+    { "churn", benchChurn },
+    { "fragmentation", benchFragmentation },
+    { "refcount", benchRefcount },
+    { "mark", benchMark },
+};
+
+//------------------------------------------------------
+// runBenchmark
+//
+// PURPOSE: Runs one workload on a fresh pool and prints a line of
+// key=value pairs with its cost per operation and its pauses.
+//------------------------------------------------------
+static void runBenchmark(const Benchmark *benchmark, const long operations)
+{
+    ObjectPool* pool = createPool(BENCH_POOL_SIZE);
+    Pauses pauses;
+    PoolStats stats;
+    struct timespec start;
+    struct timespec end;
+
+    memset(&pauses, 0, sizeof(pauses));
+    setPoolEventHook(pool, recordPause, &pauses);
+    setPoolGcThreads(pool, gcThreads);
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    benchmark->run(pool, operations);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    poolGetStats(pool, &stats);
+
+    double seconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+    unsigned long maxPause = pausePercentile(&pauses, 100);
+    unsigned long p99Pause = pausePercentile(&pauses, 99);
+
+    printf("benchmark=%s operations=%ld gc_threads=%d ns_per_op=%.1f collections=%lu collections_per_second=%.1f max_pause_us=%.1f p99_pause_us=%.1f failures=%lu\n",
+        benchmark->name, operations, gcThreads, seconds * 1e9 / operations, stats.collections, stats.collections / seconds,
+        maxPause / 1000.0, p99Pause / 1000.0, stats.allocationFailures);
+
+    freePauses(&pauses);
+    deletePool(pool);
+}
+
+int main(int argc, char const *argv[])
+{
+    long operations = 1000000;
+    const char* only = NULL;
+
+    if (argc > 1)
+    {
+        operations = atol(argv[1]);
+    }
+
+    if (argc > 2)
+    {
+        only = argv[2];
+    }
+
+    if (argc > 3)
+    {
+        gcThreads = atoi(argv[3]);
+    }
+
+    if (operations < 1)
+    {
+        operations = 1;
+    }
+
+    for (size_t i = 0; i < sizeof(benchmarks) / sizeof(benchmarks[0]); i++)
+    {
+        if (only == NULL || strcmp(only, benchmarks[i].name) == 0)
+        {
+            runBenchmark(&benchmarks[i], operations);
+        }
+    }
+
+    return 0;
+}
@@ -0,0 +1,72 @@
+#include <stdlib.h>
+#include "pauses.h"
+
+//------------------------------------------------------
+// recordPause
+//
+// PURPOSE: The event hook of the pool, times every collection from its
+// begin to its end event.
+//------------------------------------------------------
+void recordPause(const GcEvent *event, void *context)
+{
+    Pauses* pauses = (Pauses*) context;
+
+    if (event->type == GC_EVENT_BEGIN)
+    {
+        pauses->begun = event->timestamp;
+    }
+    else if (event->type == GC_EVENT_END)
+    {
+        if (pauses->count == pauses->capacity)
+        {
+            pauses->capacity = pauses->capacity == 0 ? 1024 : pauses->capacity * 2;
+            pauses->nanos = (unsigned long*) realloc(pauses->nanos, pauses->capacity * sizeof(unsigned long));
+        }
+
+        pauses->nanos[pauses->count++] = event->timestamp - pauses->begun;
+    }
+}
+
+static int compareNanos(const void *a, const void *b)
+{
+    unsigned long left = *(const unsigned long*) a;
+    unsigned long right = *(const unsigned long*) b;
+
+    return left < right ? -1 : left > right;
+}
+
+//------------------------------------------------------
+// pausePercentile
+//
+// PURPOSE: Sorts the pauses and picks the one the given share of them
+// are no longer than, the longest for 100.
+//------------------------------------------------------
+unsigned long pausePercentile(Pauses *pauses, int percent)
+{
+    unsigned long pause = 0;
+
+    if (pauses->count > 0)
+    {
+        long index = (long) pauses->count * percent / 100;
+
+        qsort(pauses->nanos, pauses->count, sizeof(unsigned long), compareNanos);
+
+        pause = pauses->nanos[index < pauses->count ? index : pauses->count - 1];
+    }
+
+    return pause;
+}
+
+//------------------------------------------------------
+// freePauses
+//
+// PURPOSE: Releases the pauses collected.
+//------------------------------------------------------
+void freePauses(Pauses *pauses)
+{
+    free(pauses->nanos);
+
+    pauses->nanos = NULL;
+    pauses->count = 0;
+    pauses->capacity = 0;
+}
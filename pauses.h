@@ -0,0 +1,28 @@
+#ifndef _PAUSES_H
+#define _PAUSES_H
+
+#include "ObjectManager.h"
+
+// The pauses of every collection of a pool, timed by recordPause from the begin event of a
+// collection to its end event. Shared by the tools so they all report pauses the same way.
+typedef struct PAUSES Pauses;
+
+struct PAUSES
+{
+    unsigned long begun;
+    unsigned long *nanos;
+    int count;
+    int capacity;
+};
+
+// The event hook that collects the pauses, context is a Pauses cleared to zero.
+void recordPause( const GcEvent *event, void *context );
+
+// The pause percent of the pauses are no longer than, in nanoseconds, 0 when there were none.
+// 100 gives the longest pause. Sorts the pauses.
+unsigned long pausePercentile( Pauses *pauses, int percent );
+
+// Releases the pauses collected, leaving pauses empty.
+void freePauses( Pauses *pauses );
+
+#endif
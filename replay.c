@@ -0,0 +1,281 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "ObjectManager.h"
+#include "pauses.h"
+
+// Slots in the table of recorded references to start with, always a power of two.
+#define FIRST_MAPPINGS 4096
+
+typedef struct MAPPING Mapping;
+
+// A reference from the recording and the one the replay got for the same object.
+struct MAPPING
+{
+    Ref recorded;
+    Ref replayed;
+};
+
+static Mapping *mappings = NULL;
+static unsigned long mappingSlots = 0;
+static unsigned long mappingCount = 0;
+
+//------------------------------------------------------
+// findMapping
+//
+// PURPOSE: Finds the slot of a recorded reference in the table, or the
+// empty slot it would go in. References are never removed, the
+// recording never hands out the same one twice.
+//------------------------------------------------------
+static Mapping *findMapping(const Ref recorded)
+{
+    unsigned long slot = (recorded * 11400714819323198485UL) & (mappingSlots - 1);
+
+    while (mappings[slot].recorded != NULL_REF && mappings[slot].recorded != recorded)
+    {
+        slot = (slot + 1) & (mappingSlots - 1);
+    }
+
+    return &mappings[slot];
+}
+
+//------------------------------------------------------
+// addMapping
+//
+// PURPOSE: Remembers which replayed reference stands for a recorded one,
+// doubling the table when it gets half full.
+//------------------------------------------------------
+static void addMapping(const Ref recorded, const Ref replayed)
+{
+    if ((mappingCount + 1) * 2 > mappingSlots)
+    {
+        Mapping* old = mappings;
+        unsigned long oldSlots = mappingSlots;
+
+        mappingSlots = mappingSlots == 0 ? FIRST_MAPPINGS : mappingSlots * 2;
+        mappings = (Mapping*) calloc(mappingSlots, sizeof(Mapping));
+
+        for (unsigned long i = 0; i < oldSlots; i++)
+        {
+            if (old[i].recorded != NULL_REF)
+            {
+                *findMapping(old[i].recorded) = old[i];
+            }
+        }
+
+        free(old);
+    }
+
+    Mapping* mapping = findMapping(recorded);
+
+    if (mapping->recorded == NULL_REF)
+    {
+        mappingCount++;
+    }
+
+    mapping->recorded = recorded;
+    mapping->replayed = replayed;
+}
+
+//------------------------------------------------------
+// replayedRef
+//
+// PURPOSE: Looks up the replayed reference for a recorded one.
+// NULL_REF if the object was never inserted by the replay.
+//------------------------------------------------------
+static Ref replayedRef(const Ref recorded)
+{
+    Ref replayed = NULL_REF;
+
+    if (mappingSlots > 0 && recorded != NULL_REF)
+    {
+        replayed = findMapping(recorded)->replayed;
+    }
+
+    return replayed;
+}
+
+//------------------------------------------------------
+// replayCall
+//
+// PURPOSE: Makes one recorded call on the pool. Calls about objects the
+// replay could not insert are skipped and counted.
+//------------------------------------------------------
+static int replayCall(ObjectPool *pool, const PoolCall *call)
+{
+    int skipped = 0;
+    Ref ref = replayedRef(call->ref);
+
+    switch (call->call)
+    {
+        case POOL_CALL_INSERT:
+        case POOL_CALL_INSERT_ALIGNED:
+            ref = call->call == POOL_CALL_INSERT_ALIGNED ? poolInsertAlignedObject(pool, call->value, call->detail)
+                : poolInsertObject(pool, call->value);
+
+            if (call->ref != NULL_REF)
+            {
+                addMapping(call->ref, ref);
+            }
+            else if (ref != NULL_REF)
+            {
+                // the recorded insert failed, nothing will ever drop this object
+                poolDropReference(pool, ref);
+            }
+            break;
+
+        case POOL_CALL_COLLECT_STEP:
+            poolCollectStep(pool, call->value);
+            break;
+
+        case POOL_CALL_SET_ALIGNMENT:
+            setPoolAlignment(pool, call->value);
+            break;
+
+        case POOL_CALL_SET_TRACING:
+            // main stops at any call turning tracing on, so the replay never traces
+            break;
+
+        default:
+            if (ref == NULL_REF)
+            {
+                skipped = 1;
+            }
+            else if (call->call == POOL_CALL_ADD_REFERENCE)
+            {
+                poolAddReference(pool, ref);
+            }
+            else if (call->call == POOL_CALL_DROP_REFERENCE)
+            {
+                poolDropReference(pool, ref);
+            }
+            else if (call->call == POOL_CALL_PIN)
+            {
+                poolPinObject(pool, ref);
+            }
+            else
+            {
+                poolUnpinObject(pool, ref);
+            }
+            break;
+    }
+
+    return skipped;
+}
+
+//------------------------------------------------------
+// overrideSetup
+//
+// PURPOSE: Takes a setting from the command line, unless it was left
+// out or given as "-" to keep the one recorded.
+//------------------------------------------------------
+static long overrideSetup(int argc, char const *argv[], const int arg, const long recorded)
+{
+    return argc > arg && strcmp(argv[arg], "-") != 0 ? atol(argv[arg]) : recorded;
+}
+
+int main(int argc, char const *argv[])
+{
+    char magic[RECORDING_MAGIC_SIZE];
+    PoolSetup setup;
+    PoolCall call;
+    Pauses pauses;
+    PoolStats stats;
+    struct timespec start;
+    struct timespec end;
+    unsigned long calls = 0;
+    unsigned long skipped = 0;
+    unsigned long recordedNanos = 0;
+
+    if (argc < 2)
+    {
+        fprintf(stderr, "usage: %s recording [bytes] [maximum_bytes] [nursery_bytes] [pause_budget_us]\n", argv[0]);
+        fprintf(stderr, "The pool is set up as it was recorded, a setting given here or left as - overrides it or keeps it.\n");
+        return 1;
+    }
+
+    FILE* in = fopen(argv[1], "rb");
+
+    if (in == NULL || fread(magic, 1, RECORDING_MAGIC_SIZE, in) != RECORDING_MAGIC_SIZE
+        || memcmp(magic, RECORDING_MAGIC, RECORDING_MAGIC_SIZE) != 0 || fread(&setup, sizeof(PoolSetup), 1, in) != 1)
+    {
+        fprintf(stderr, "'%s' is not a pool recording.\n", argv[1]);
+        return 1;
+    }
+
+    // stores into reference slots are not recorded, so a replay could not tell what keeps objects alive
+    if (setup.tracing)
+    {
+        fprintf(stderr, "'%s' is a recording of a tracing pool, which cannot be replayed.\n", argv[1]);
+        return 1;
+    }
+
+    setup.size = overrideSetup(argc, argv, 2, setup.size);
+    setup.maximumSize = overrideSetup(argc, argv, 3, setup.maximumSize);
+    setup.nurseryBytes = overrideSetup(argc, argv, 4, setup.nurseryBytes);
+    setup.pauseBudget = overrideSetup(argc, argv, 5, setup.pauseBudget);
+
+    ObjectPool* pool = createGrowablePool((size_t) setup.size, (size_t) setup.maximumSize);
+
+    if (pool == NULL)
+    {
+        return 1;
+    }
+
+    if (setup.nurseryBytes > 0)
+    {
+        setPoolGenerational(pool, (size_t) setup.nurseryBytes, setup.promotionAge);
+    }
+
+    setPoolPauseBudget(pool, setup.pauseBudget);
+    setPoolLargeObjectSize(pool, setup.largeObjectSize);
+    setPoolAlignment(pool, setup.alignment);
+
+    memset(&pauses, 0, sizeof(pauses));
+    setPoolEventHook(pool, recordPause, &pauses);
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    while (fread(&call, sizeof(PoolCall), 1, in) == 1)
+    {
+        if (call.call == POOL_CALL_INSERT_TRACED || (call.call == POOL_CALL_SET_TRACING && call.value))
+        {
+            fprintf(stderr, "'%s' turns to tracing after %lu calls, which cannot be replayed.\n", argv[1], calls);
+
+            fclose(in);
+            freePauses(&pauses);
+            free(mappings);
+            deletePool(pool);
+
+            return 1;
+        }
+
+        skipped += replayCall(pool, &call);
+        calls++;
+
+        if (call.timestamp > recordedNanos)
+        {
+            recordedNanos = call.timestamp;
+        }
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    fclose(in);
+
+    poolGetStats(pool, &stats);
+
+    double seconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+    unsigned long maxPause = pausePercentile(&pauses, 100);
+    unsigned long p99Pause = pausePercentile(&pauses, 99);
+
+    printf("calls=%lu skipped=%lu recorded_seconds=%.3f seconds=%.3f collections=%lu minor_collections=%lu max_pause_us=%.1f p99_pause_us=%.1f failures=%lu live_objects=%lu\n",
+        calls, skipped, recordedNanos / 1e9, seconds, stats.collections, stats.minorCollections,
+        maxPause / 1000.0, p99Pause / 1000.0, stats.allocationFailures, stats.liveObjects);
+
+    freePauses(&pauses);
+    free(mappings);
+    deletePool(pool);
+
+    return 0;
+}
@@ -0,0 +1,222 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+#include "ObjectManager.h"
+
+// Small enough that the pool collects many times during a run.
+#define STRESS_POOL_SIZE (1024*1024)
+
+// Objects every thread keeps alive at once.
+#define RING_SIZE 32
+
+// Objects that every thread adds and drops references to.
+#define SHARED_OBJECTS 16
+
+#define MAX_THREADS 64
+
+static ObjectPool *pool = NULL;
+static Ref shared[SHARED_OBJECTS];
+static int operations = 200000;
+static int failures = 0;
+
+typedef struct WORKER Worker;
+
+struct WORKER
+{
+    pthread_t thread;
+    unsigned long id;
+};
+
+//------------------------------------------------------
+// nextRandom
+//
+// PURPOSE: A small xorshift generator so threads don't share rand() state.
+//------------------------------------------------------
+static unsigned long nextRandom(unsigned long *state)
+{
+    *state ^= *state << 13;
+    *state ^= *state >> 7;
+    *state ^= *state << 17;
+    return *state;
+}
+
+//------------------------------------------------------
+// checkObject
+//
+// PURPOSE: Verifies that an object still holds the stamp it was filled with.
+//------------------------------------------------------
+static void checkObject(const Ref ref, const unsigned long stamp)
+{
+    beginPoolAccess(pool);
+
+    unsigned long* object = (unsigned long*) poolRetrieveObject(pool, ref);
+
+    if (object == NULL || object[0] != stamp || object[1] != stamp)
+    {
+        __atomic_add_fetch(&failures, 1, __ATOMIC_RELAXED);
+    }
+
+    endPoolAccess(pool);
+}
+
+//------------------------------------------------------
+// worker
+//
+// PURPOSE: Churns objects through the shared pool while hammering the
+// reference counts of the shared objects.
+//------------------------------------------------------
+static void *worker(void *arg)
+{
+    Worker* self = (Worker*) arg;
+    unsigned long random = 88172645463325252UL ^ (self->id * 2654435761UL);
+    Ref ring[RING_SIZE];
+    unsigned long stamps[RING_SIZE];
+    int next = 0;
+
+    memset(ring, 0, sizeof(ring));
+
+    for (int i = 0; i < operations; i++)
+    {
+        int size = 16 + (int) (nextRandom(&random) % 240);
+        unsigned long stamp = (self->id << 32) | (unsigned long) i;
+
+        if (ring[next] != NULL_REF)
+        {
+            checkObject(ring[next], stamps[next]);
+            poolDropReference(pool, ring[next]);
+        }
+
+        ring[next] = poolInsertObject(pool, size);
+        stamps[next] = stamp;
+
+        if (ring[next] == NULL_REF)
+        {
+            __atomic_add_fetch(&failures, 1, __ATOMIC_RELAXED);
+        }
+        else
+        {
+            beginPoolAccess(pool);
+
+            unsigned long* object = (unsigned long*) poolRetrieveObject(pool, ring[next]);
+            object[0] = stamp;
+            object[1] = stamp;
+
+            endPoolAccess(pool);
+        }
+
+        next = (next + 1) % RING_SIZE;
+
+        Ref target = shared[nextRandom(&random) % SHARED_OBJECTS];
+
+        poolAddReference(pool, target);
+        checkObject(target, target);
+        poolDropReference(pool, target);
+    }
+
+    for (int i = 0; i < RING_SIZE; i++)
+    {
+        if (ring[i] != NULL_REF)
+        {
+            checkObject(ring[i], stamps[i]);
+            poolDropReference(pool, ring[i]);
+        }
+    }
+
+    return NULL;
+}
+
+//------------------------------------------------------
+// runStress
+//
+// PURPOSE: Runs the workload on the given number of threads, with or
+// without a background collector, and reports the throughput.
+//------------------------------------------------------
+static void runStress(const int threads, const int background)
+{
+    Worker workers[MAX_THREADS];
+    struct timespec start;
+    struct timespec end;
+
+    pool = createPool(STRESS_POOL_SIZE);
+    setPoolConcurrent(pool, 1);
+    setPoolBackgroundCollection(pool, background);
+
+    for (int i = 0; i < SHARED_OBJECTS; i++)
+    {
+        shared[i] = poolInsertObject(pool, 64);
+
+        unsigned long* object = (unsigned long*) poolRetrieveObject(pool, shared[i]);
+        object[0] = shared[i];
+        object[1] = shared[i];
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    for (int i = 0; i < threads; i++)
+    {
+        workers[i].id = (unsigned long) i + 1;
+        pthread_create(&workers[i].thread, NULL, worker, &workers[i]);
+    }
+
+    for (int i = 0; i < threads; i++)
+    {
+        pthread_join(workers[i].thread, NULL);
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    for (int i = 0; i < SHARED_OBJECTS; i++)
+    {
+        checkObject(shared[i], shared[i]);
+    }
+
+    double seconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+    PoolStats stats;
+
+    poolGetStats(pool, &stats);
+
+    fprintf(stderr, "threads=%d collector=%s operations=%d seconds=%.3f ops_per_second=%.0f collections=%lu max_pause_us=%lu\n",
+        threads, background ? "background" : "inline", threads * operations, seconds, threads * operations / seconds,
+        stats.collections, stats.maxPauseNanos / 1000);
+
+    deletePool(pool);
+}
+
+int main(int argc, char const *argv[])
+{
+    int maxThreads = (int) sysconf(_SC_NPROCESSORS_ONLN);
+
+    if (argc > 1)
+    {
+        maxThreads = atoi(argv[1]);
+    }
+
+    if (argc > 2)
+    {
+        operations = atoi(argv[2]);
+    }
+
+    // always run some threads, even on one core, so the locking gets exercised
+    if (maxThreads < 4)
+    {
+        maxThreads = 4;
+    }
+
+    if (maxThreads > MAX_THREADS)
+    {
+        maxThreads = MAX_THREADS;
+    }
+
+    for (int threads = 1; threads <= maxThreads; threads *= 2)
+    {
+        runStress(threads, 0);
+        runStress(threads, 1);
+    }
+
+    printf("\nNumber of failed checks: %d\n", failures);
+
+    return failures == 0 ? 0 : 1;
+}
@@ -1,5 +1,8 @@
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
 #include "ObjectManager.h"
 
 static int testsExecuted = 0;
@@ -80,7 +83,7 @@ void testCompaction()
 
     dropReference(compact);  // drop this
 
-    insertObject(MEMORY_SIZE); 
+    collectStep(0);
 
     if (retrieveObject(compact) == NULL_REF)
     {
@@ -96,6 +99,53 @@ void testCompaction()
     destroyPool();
 }
 
+//------------------------------------------------------
+// testCompactionKeepsData
+//
+// PURPOSE: Testing that live objects keep their contents when they
+// are slid down over a collected object.
+//------------------------------------------------------
+void testCompactionKeepsData()
+{
+    testsExecuted++;
+    fprintf(stderr, "\nTesting that compaction keeps the data of live objects.\n");
+    initPool();
+
+    Ref first = insertObject(100);
+    Ref garbage = insertObject(10000);
+    Ref last = insertObject(100);
+
+    memset(retrieveObject(first), 'a', 100);
+    memset(retrieveObject(last), 'c', 100);
+
+    char* before = (char*) retrieveObject(last);
+
+    dropReference(garbage);
+
+    collectStep(0); // force a collection
+
+    char a_array[100];
+    char c_array[100];
+    memset(a_array, 'a', 100);
+    memset(c_array, 'c', 100);
+
+    char* array_a = (char*) retrieveObject(first);
+    char* array_c = (char*) retrieveObject(last);
+
+    if (array_a != NULL_REF && array_c != NULL_REF && array_c < before
+        && memcmp(array_a, a_array, 100) == 0 && memcmp(array_c, c_array, 100) == 0)
+    {
+        fprintf(stderr, "SUCESS: Live objects were moved down with their data.\n");
+    }
+    else
+    {
+        testsFailed++;
+        fprintf(stderr, "FAILED: Live objects lost their data during compaction.\n");
+    }
+
+    destroyPool();
+}
+
 //------------------------------------------------------
 // testInsertAndRetrive
 //
@@ -187,6 +237,40 @@ void testInsertFull()
     destroyPool();
 }
 
+//------------------------------------------------------
+// testInsertWholePool
+//
+// PURPOSE: Testing that the largest object an empty pool holds leaves
+// room for its header, and that a bigger one fails without collecting.
+//------------------------------------------------------
+void testInsertWholePool()
+{
+    testsExecuted++;
+    fprintf(stderr, "\nTesting inserting objects the size of the whole pool.\n");
+    initPool();
+
+    PoolStats stats;
+    Ref whole = insertObject(MEMORY_SIZE);
+
+    poolGetStats(getDefaultPool(), &stats);
+
+    Ref largest = insertObject(MEMORY_SIZE - OBJECT_HEADER_SIZE);
+
+    if (whole == NULL_REF && stats.collections == 0 && largest != NULL_REF)
+    {
+        fprintf(stderr, "SUCESS: Inserted '%d' bytes but not '%d' into an empty pool.\n",
+            MEMORY_SIZE - OBJECT_HEADER_SIZE, MEMORY_SIZE);
+    }
+    else
+    {
+        testsFailed++;
+        fprintf(stderr, "FAILED: Inserting the whole pool returned '%lu' after '%lu' collections, the largest object '%lu'.\n",
+            whole, stats.collections, largest);
+    }
+
+    destroyPool();
+}
+
 //------------------------------------------------------
 // testRevialEmpty
 //
@@ -246,7 +330,7 @@ void testAddReference()
 //------------------------------------------------------
 // testDropReference
 //
-// PURPOSE: Testing drop reference count.
+// PURPOSE: Testing that dropping the last reference frees the object.
 //------------------------------------------------------
 void testDropReference()
 {
@@ -265,32 +349,1699 @@ void testDropReference()
     {
         dropReference(ref);
 
-        fprintf(stderr, "INFO: There should be '0' counts for the reference with id of '1'.\n");
+        fprintf(stderr, "INFO: The pool should be empty.\n");
         dumpPool();
+
+        if (retrieveObject(ref) == NULL)
+        {
+            fprintf(stderr, "SUCESS: The object was freed with its last reference.\n");
+        }
+        else
+        {
+            testsFailed++;
+            fprintf(stderr, "FAILED: The object can still be retrieved after dropping its last reference.\n");
+        }
     }
 
     destroyPool();    
 }
 
 
-int main(int argc, char const *argv[])
+//------------------------------------------------------
+// testStaleReference
+//
+// PURPOSE: Testing that a reference to a collected object stays invalid
+// after its slot has been reused by a new object.
+//------------------------------------------------------
+void testStaleReference()
 {
-    fprintf(stderr, "------------------------------------------------\n");
-    testInitalizePool();
-    fprintf(stderr, "------------------------------------------------\n");
-    testInsertEmpty();
-    fprintf(stderr, "------------------------------------------------\n");
-    testCompaction();
-    fprintf(stderr, "------------------------------------------------\n");
-    testInsertAndRetrive();
-    fprintf(stderr, "------------------------------------------------\n");
-    testInsertFull();
-    fprintf(stderr, "------------------------------------------------\n");
-    testRevialEmpty();
-    fprintf(stderr, "------------------------------------------------\n");
-    testAddReference();
-    fprintf(stderr, "------------------------------------------------\n");
-    testDropReference();
+    testsExecuted++;
+    fprintf(stderr, "\nTesting stale references after collection.\n");
+    initPool();
+
+    Ref stale = insertObject(MEMORY_SIZE / 2);
+
+    dropReference(stale);
+
+    // forces a collection, after which the new object reuses the slot
+    Ref reused = insertObject(MEMORY_SIZE / 2 + 1024);
+
+    if (reused != NULL_REF && reused != stale && retrieveObject(stale) == NULL_REF && retrieveObject(reused) != NULL_REF)
+    {
+        fprintf(stderr, "SUCESS: Stale reference was not resolved to the new object.\n");
+    }
+    else
+    {
+        testsFailed++;
+        fprintf(stderr, "FAILED: Stale reference resolved after its object was collected.\n");
+    }
+
+    destroyPool();
+}
+
+//------------------------------------------------------
+// testManyObjects
+//
+// PURPOSE: Testing that the index keeps working once it has to grow
+// past its first slab and recycle the entries of collected objects.
+//------------------------------------------------------
+void testManyObjects()
+{
+    testsExecuted++;
+    fprintf(stderr, "\nTesting an index with thousands of objects.\n");
+    initPool();
+
+    static Ref refs[3000];
+    int failed = 0;
+
+    for (size_t i = 0; i < 3000; i++)
+    {
+        refs[i] = insertObject(sizeof(int));
+        *(int*) retrieveObject(refs[i]) = (int) i;
+
+        if (i % 2 == 1)
+        {
+            dropReference(refs[i]);
+        }
+    }
+
+    collectStep(0); // force a collection
+
+    for (size_t i = 1; i < 3000; i += 2)
+    {
+        refs[i] = insertObject(sizeof(int));
+        *(int*) retrieveObject(refs[i]) = (int) i;
+    }
+
+    for (size_t i = 0; i < 3000; i++)
+    {
+        int* value = (int*) retrieveObject(refs[i]);
+
+        if (value == NULL_REF || *value != (int) i)
+        {
+            failed = 1;
+        }
+    }
+
+    if (!failed)
+    {
+        fprintf(stderr, "SUCESS: Found every one of '3000' objects.\n");
+    }
+    else
+    {
+        testsFailed++;
+        fprintf(stderr, "FAILED: Lost objects in an index with '3000' objects.\n");
+    }
+
+    destroyPool();
+}
+
+//------------------------------------------------------
+// testIndependentPools
+//
+// PURPOSE: Testing that separate pools do not share objects or collections.
+//------------------------------------------------------
+void testIndependentPools()
+{
+    testsExecuted++;
+    fprintf(stderr, "\nTesting independent object pools.\n");
+
+    ObjectPool* first = createPool(4096);
+    ObjectPool* second = createPool(4096);
+
+    Ref a = poolInsertObject(first, 1000);
+    Ref b = poolInsertObject(second, 1000);
+
+    memset(poolRetrieveObject(first, a), 'a', 1000);
+    memset(poolRetrieveObject(second, b), 'b', 1000);
+
+    char* before = (char*) poolRetrieveObject(second, b);
+
+    // fill the first pool until it has to collect
+    poolDropReference(first, a);
+    Ref big = poolInsertObject(first, 3500);
+
+    char b_array[1000];
+    memset(b_array, 'b', 1000);
+
+    if (big != NULL_REF && poolRetrieveObject(first, a) == NULL_REF
+        && poolRetrieveObject(second, b) == before && memcmp(before, b_array, 1000) == 0)
+    {
+        fprintf(stderr, "SUCESS: Collecting one pool left the other untouched.\n");
+    }
+    else
+    {
+        testsFailed++;
+        fprintf(stderr, "FAILED: Pools interfered with each other.\n");
+    }
+
+    deletePool(first);
+    deletePool(second);
+}
+
+//------------------------------------------------------
+// testThreadLocalChunks
+//
+// PURPOSE: Testing that objects bump allocated from a thread's private
+// chunk of a concurrent pool are still found and moved by compaction.
+//------------------------------------------------------
+void testThreadLocalChunks()
+{
+    testsExecuted++;
+    fprintf(stderr, "\nTesting compaction of objects in thread-local chunks.\n");
+
+    ObjectPool* pool = createPool(64 * 1024);
+    setPoolConcurrent(pool, 1);
+
+    static Ref refs[2000];
+    int failed = 0;
+
+    // keep every other object, 2000 of them make the pool collect a few times
+    for (int i = 0; i < 2000; i++)
+    {
+        refs[i] = poolInsertObject(pool, 24);
+
+        beginPoolAccess(pool);
+        int* value = (int*) poolRetrieveObject(pool, refs[i]);
+        value[0] = i;
+        endPoolAccess(pool);
+
+        if (i % 2 == 1)
+        {
+            poolDropReference(pool, refs[i]);
+        }
+    }
+
+    for (int i = 0; i < 2000; i += 2)
+    {
+        int* value = (int*) poolRetrieveObject(pool, refs[i]);
+
+        if (value == NULL_REF || value[0] != i)
+        {
+            failed = 1;
+        }
+    }
+
+    if (!failed)
+    {
+        fprintf(stderr, "SUCESS: Found every live object after collecting thread-local chunks.\n");
+    }
+    else
+    {
+        testsFailed++;
+        fprintf(stderr, "FAILED: Lost objects allocated from thread-local chunks.\n");
+    }
+
+    deletePool(pool);
+}
+
+//------------------------------------------------------
+// testFreeListReuse
+//
+// PURPOSE: Testing that the space of a dropped object is reused by the
+// next insert that fits, without waiting for a compaction.
+//------------------------------------------------------
+void testFreeListReuse()
+{
+    testsExecuted++;
+    fprintf(stderr, "\nTesting reuse of dropped objects without compaction.\n");
+    initPool();
+
+    insertObject(100);
+    Ref dropped = insertObject(200);
+    Ref last = insertObject(100);
+
+    void* hole = retrieveObject(dropped);
+    void* before = retrieveObject(last);
+
+    dropReference(dropped);
+
+    Ref reused = insertObject(200);
+
+    if (retrieveObject(reused) == hole && retrieveObject(last) == before)
+    {
+        fprintf(stderr, "SUCESS: Reused the '200' bytes of a dropped object in place.\n");
+    }
+    else
+    {
+        testsFailed++;
+        fprintf(stderr, "FAILED: Did not reuse the space of a dropped object.\n");
+    }
+
+    destroyPool();
+}
+
+//------------------------------------------------------
+// testNurseryPromotion
+//
+// PURPOSE: Testing that an object surviving nursery collections is
+// promoted with its data, and is left alone by the collections after.
+//------------------------------------------------------
+void testNurseryPromotion()
+{
+    testsExecuted++;
+    fprintf(stderr, "\nTesting promotion out of the nursery.\n");
+
+    ObjectPool* pool = createPool(64 * 1024);
+    setPoolGenerational(pool, 16 * 1024, 1);
+
+    Ref dropped = poolInsertObject(pool, 100);
+    Ref survivor = poolInsertObject(pool, 100);
+    poolDropReference(pool, dropped);
+
+    strcpy((char*) poolRetrieveObject(pool, survivor), "survivor");
+
+    // fill the nursery with garbage until the survivor has been promoted
+    for (int i = 0; i < 400; i++)
+    {
+        poolDropReference(pool, poolInsertObject(pool, 200));
+    }
+
+    char* promoted = (char*) poolRetrieveObject(pool, survivor);
+
+    for (int i = 0; i < 400; i++)
+    {
+        poolDropReference(pool, poolInsertObject(pool, 200));
+    }
+
+    char* after = (char*) poolRetrieveObject(pool, survivor);
+
+    if (after == promoted && after != NULL && strcmp(after, "survivor") == 0)
+    {
+        fprintf(stderr, "SUCESS: Promoted object kept its data and stayed put.\n");
+    }
+    else
+    {
+        testsFailed++;
+        fprintf(stderr, "FAILED: Promoted object was moved or lost its data.\n");
+    }
+
+    deletePool(pool);
+}
+
+//------------------------------------------------------
+// testIncrementalCompaction
+//
+// PURPOSE: Testing that compacting a step at a time slides the objects
+// down and keeps their data, however the steps fall.
+//------------------------------------------------------
+void testIncrementalCompaction()
+{
+    testsExecuted++;
+    fprintf(stderr, "\nTesting compaction in small steps.\n");
+
+    ObjectPool* pool = createPool(64 * 1024);
+    Ref kept[100];
+    int steps = 1;
+    int intact = 1;
+
+    for (int i = 0; i < 100; i++)
+    {
+        Ref garbage = poolInsertObject(pool, 200);
+        kept[i] = poolInsertObject(pool, 200);
+        poolDropReference(pool, garbage);
+
+        sprintf((char*) poolRetrieveObject(pool, kept[i]), "kept %d", i);
+    }
+
+    char* before = (char*) poolRetrieveObject(pool, kept[99]);
+
+    // a microsecond covers only part of the pool, so this usually takes several steps
+    while (poolCollectStep(pool, 1))
+    {
+        steps++;
+    }
+
+    for (int i = 0; i < 100; i++)
+    {
+        char expected[16];
+        sprintf(expected, "kept %d", i);
+
+        intact = intact && strcmp((char*) poolRetrieveObject(pool, kept[i]), expected) == 0;
+    }
+
+    if (intact && (char*) poolRetrieveObject(pool, kept[99]) < before)
+    {
+        fprintf(stderr, "SUCESS: Compacted in %d steps without losing data.\n", steps);
+    }
+    else
+    {
+        testsFailed++;
+        fprintf(stderr, "FAILED: Stepped compaction lost data or did not compact.\n");
+    }
+
+    deletePool(pool);
+}
+
+//------------------------------------------------------
+// testBackgroundCollection
+//
+// PURPOSE: Testing that objects keep their data while a background
+// thread collects the pool under the inserts.
+//------------------------------------------------------
+void testBackgroundCollection()
+{
+    testsExecuted++;
+    fprintf(stderr, "\nTesting collection on a background thread.\n");
+
+    ObjectPool* pool = createPool(64 * 1024);
+    setPoolConcurrent(pool, 1);
+    setPoolGenerational(pool, 16 * 1024, 2);
+    setPoolBackgroundCollection(pool, 1);
+
+    Ref kept[32];
+    int intact = 1;
+
+    for (int i = 0; i < 32; i++)
+    {
+        kept[i] = NULL_REF;
+    }
+
+    for (int i = 0; i < 5000 && intact; i++)
+    {
+        int slot = i % 32;
+
+        // the collector can move objects at any time outside of an access section
+        if (kept[slot] != NULL_REF)
+        {
+            beginPoolAccess(pool);
+
+            int* object = (int*) poolRetrieveObject(pool, kept[slot]);
+            intact = (object != NULL && object[0] == i - 32);
+
+            endPoolAccess(pool);
+
+            poolDropReference(pool, kept[slot]);
+        }
+
+        kept[slot] = poolInsertObject(pool, 100 + (i % 7) * 50);
+
+        intact = intact && kept[slot] != NULL_REF;
+
+        if (intact)
+        {
+            beginPoolAccess(pool);
+            *(int*) poolRetrieveObject(pool, kept[slot]) = i;
+            endPoolAccess(pool);
+        }
+    }
+
+    deletePool(pool);
+
+    if (intact)
+    {
+        fprintf(stderr, "SUCESS: Objects kept their data under a background collector.\n");
+    }
+    else
+    {
+        testsFailed++;
+        fprintf(stderr, "FAILED: An object was lost under a background collector.\n");
+    }
+}
+
+//------------------------------------------------------
+// testBatchInsert
+//
+// PURPOSE: Testing that a batch insert into a pool full of garbage
+// inserts the whole batch, and that batch count
+// updates free the objects when their counts reach zero.
+//------------------------------------------------------
+void testBatchInsert()
+{
+    testsExecuted++;
+    fprintf(stderr, "\nTesting batch inserts and reference updates.\n");
+
+    ObjectPool* pool = createPool(16 * 1024);
+    int sizes[50];
+    Ref refs[50];
+    int intact = 1;
+
+    // leave the pool full of dropped objects, so the batch has to reuse or collect their space
+    for (int i = 0; i < 40; i++)
+    {
+        refs[i] = poolInsertObject(pool, 400);
+    }
+
+    poolDropReferences(pool, refs, 40);
+
+    for (int i = 0; i < 50; i++)
+    {
+        sizes[i] = 100 + i;
+    }
+
+    int inserted = poolInsertObjects(pool, sizes, refs, 50);
+
+    for (int i = 0; i < inserted; i++)
+    {
+        memset(poolRetrieveObject(pool, refs[i]), i, sizes[i]);
+    }
+
+    for (int i = 0; i < inserted; i++)
+    {
+        unsigned char* object = (unsigned char*) poolRetrieveObject(pool, refs[i]);
+
+        intact = intact && object[0] == i && object[sizes[i] - 1] == i;
+    }
+
+    poolAddReferences(pool, refs, 50);
+    poolDropReferences(pool, refs, 50);
+    poolDropReferences(pool, refs, 50);
+
+    if (inserted == 50 && intact && poolRetrieveObject(pool, refs[0]) == NULL)
+    {
+        fprintf(stderr, "SUCESS: Inserted and released a batch of '%d' objects.\n", inserted);
+    }
+    else
+    {
+        testsFailed++;
+        fprintf(stderr, "FAILED: Batch of '%d' objects was not inserted or released.\n", inserted);
+    }
+
+    deletePool(pool);
+}
+
+//------------------------------------------------------
+// testPinnedObject
+//
+// PURPOSE: Testing that compaction works around a pinned object, reuses
+// the room below it, and moves it again once it is unpinned.
+//------------------------------------------------------
+void testPinnedObject()
+{
+    testsExecuted++;
+    fprintf(stderr, "\nTesting compaction around a pinned object.\n");
+
+    ObjectPool* pool = createPool(16 * 1024);
+
+    Ref garbage = poolInsertObject(pool, 1000);
+    Ref pinned = poolInsertObject(pool, 100);
+    poolInsertObject(pool, 100);
+    poolDropReference(pool, garbage);
+
+    char* pointer = (char*) poolPinObject(pool, pinned);
+    strcpy(pointer, "pinned");
+
+    poolCollectStep(pool, 0);
+
+    int stayed = (poolRetrieveObject(pool, pinned) == pointer);
+
+    // the room the garbage left below the pinned object is reused
+    Ref below = poolInsertObject(pool, 900);
+    int reused = ((char*) poolRetrieveObject(pool, below) < pointer);
+
+    poolUnpinObject(pool, pinned);
+    poolCollectStep(pool, 0);
+
+    char* moved = (char*) poolRetrieveObject(pool, pinned);
+
+    if (stayed && reused && moved != pointer && strcmp(moved, "pinned") == 0)
+    {
+        fprintf(stderr, "SUCESS: Pinned object stayed put and moved again once unpinned.\n");
+    }
+    else
+    {
+        testsFailed++;
+        fprintf(stderr, "FAILED: Compaction did not respect the pin.\n");
+    }
+
+    deletePool(pool);
+}
+
+//------------------------------------------------------
+// testGrowablePool
+//
+// PURPOSE: Testing that a growable pool grows past its initial size
+// without moving the objects already in it, and stops at its maximum.
+//------------------------------------------------------
+void testGrowablePool()
+{
+    testsExecuted++;
+    fprintf(stderr, "\nTesting a pool that grows in place.\n");
+
+    ObjectPool* pool = createGrowablePool(16 * 1024, 256 * 1024);
+    Ref refs[200];
+    int inserted = 0;
+
+    Ref first = poolInsertObject(pool, 1000);
+    char* before = (char*) poolRetrieveObject(pool, first);
+    strcpy(before, "first");
+
+    for (int i = 0; i < 200; i++)
+    {
+        refs[i] = poolInsertObject(pool, 1000);
+        inserted += (refs[i] != NULL_REF);
+    }
+
+    char* after = (char*) poolRetrieveObject(pool, first);
+
+    // 200 objects of a KiB fit in the maximum, a 100 KiB one on top of them does not
+    if (inserted == 200 && after == before && strcmp(after, "first") == 0
+        && poolInsertObject(pool, 100 * 1024) == NULL_REF)
+    {
+        fprintf(stderr, "SUCESS: Grew to hold '%d' objects without moving the first.\n", inserted);
+    }
+    else
+    {
+        testsFailed++;
+        fprintf(stderr, "FAILED: Pool did not grow in place, inserted '%d' objects.\n", inserted);
+    }
+
+    deletePool(pool);
+}
+
+//------------------------------------------------------
+// testReleaseTail
+//
+// PURPOSE: Testing that compaction hands the pages above the live data
+// back to the system, and that they are usable again afterwards.
+//------------------------------------------------------
+void testReleaseTail()
+{
+    testsExecuted++;
+    fprintf(stderr, "\nTesting that freed pages are given back after compaction.\n");
+
+    ObjectPool* pool = createPool(4 * 1024 * 1024);
+    setPoolRetainBytes(pool, 0);
+
+    long page = sysconf(_SC_PAGESIZE);
+    unsigned char resident[256];
+    int stillResident = 0;
+    Ref garbage[3000];
+
+    Ref kept = poolInsertObject(pool, 100);
+    unsigned char* start = (unsigned char*) poolRetrieveObject(pool, kept);
+
+    // touch 3 MiB of pages, then drop everything in them
+    for (int i = 0; i < 3000; i++)
+    {
+        garbage[i] = poolInsertObject(pool, 1000);
+        memset(poolRetrieveObject(pool, garbage[i]), 1, 1000);
+    }
+
+    poolDropReferences(pool, garbage, 3000);
+
+    poolCollectStep(pool, 0);
+
+    // look at a MiB that was filled with garbage before the compaction
+    unsigned char* probe = (unsigned char*) (((unsigned long) start + 1024 * 1024) & ~(page - 1));
+
+    if (mincore(probe, 256 * page, resident) == 0)
+    {
+        for (int i = 0; i < 256; i++)
+        {
+            stillResident += resident[i] & 1;
+        }
+    }
+
+    Ref reused = poolInsertObject(pool, 1000);
+
+    if (stillResident == 0 && poolRetrieveObject(pool, kept) == start && reused != NULL_REF)
+    {
+        fprintf(stderr, "SUCESS: Pages above the live data were given back.\n");
+    }
+    else
+    {
+        testsFailed++;
+        fprintf(stderr, "FAILED: '%d' pages above the live data are still resident.\n", stillResident);
+    }
+
+    deletePool(pool);
+}
+
+//------------------------------------------------------
+// testPoolStats
+//
+// PURPOSE: Testing that the stats of a pool count its collections,
+// pauses, failed inserts, live objects and fragmentation.
+//------------------------------------------------------
+void testPoolStats()
+{
+    testsExecuted++;
+    fprintf(stderr, "\nTesting the stats kept by a pool.\n");
+
+    ObjectPool* pool = createPool(16 * 1024);
+    PoolStats stats;
+    Ref kept[20];
+    Ref dropped[20];
+    unsigned long pauses = 0;
+
+    // every other object is dropped, leaving holes between the kept ones
+    for (int i = 0; i < 20; i++)
+    {
+        kept[i] = poolInsertObject(pool, 100);
+        dropped[i] = poolInsertObject(pool, 100);
+    }
+
+    poolDropReferences(pool, dropped, 20);
+
+    poolGetStats(pool, &stats);
+    double fragmented = stats.fragmentation;
+
+    // fits an empty pool but not next to the kept objects, so it fails after collecting
+    poolCollectStep(pool, 0);
+    poolInsertObject(pool, 15 * 1024);
+    poolGetStats(pool, &stats);
+
+    for (int i = 0; i < PAUSE_BUCKETS; i++)
+    {
+        pauses += stats.pauseHistogram[i];
+    }
+
+    if (fragmented > 0.0 && stats.fragmentation == 0.0 && stats.collections >= 1
+        && pauses == stats.collections && stats.bytesMoved > 0
+        && stats.allocationFailures == 1 && stats.liveObjects == 20 && stats.liveBytes == 2000
+        && poolRetrieveObject(pool, kept[19]) != NULL)
+    {
+        fprintf(stderr, "SUCESS: Counted '%lu' collections and '%lu' live objects.\n", stats.collections, stats.liveObjects);
+    }
+    else
+    {
+        testsFailed++;
+        fprintf(stderr, "FAILED: Pool stats do not add up.\n");
+    }
+
+    deletePool(pool);
+}
+
+//------------------------------------------------------
+// countEvent
+//
+// PURPOSE: Event hook for testEventHook, counts the events by type.
+//------------------------------------------------------
+static void countEvent(const GcEvent *event, void *context)
+{
+    int* counts = (int*) context;
+
+    counts[event->type]++;
+}
+
+//------------------------------------------------------
+// testEventHook
+//
+// PURPOSE: Testing that a collection is reported to the event hook as
+// a begin and end pair with the moves made in between.
+//------------------------------------------------------
+void testEventHook()
+{
+    testsExecuted++;
+    fprintf(stderr, "\nTesting the event hook of a pool.\n");
+
+    ObjectPool* pool = createPool(16 * 1024);
+    int counts[GC_EVENT_GROW + 1] = { 0 };
+    Ref kept[20];
+    Ref dropped[20];
+
+    setPoolEventHook(pool, countEvent, counts);
+
+    for (int i = 0; i < 20; i++)
+    {
+        dropped[i] = poolInsertObject(pool, 100);
+        kept[i] = poolInsertObject(pool, 100);
+    }
+
+    poolDropReferences(pool, dropped, 20);
+    poolCollectStep(pool, 0);
+
+    if (counts[GC_EVENT_BEGIN] >= 1 && counts[GC_EVENT_BEGIN] == counts[GC_EVENT_END]
+        && counts[GC_EVENT_MOVE] == 20 && counts[GC_EVENT_ALLOCATION_FAILURE] == 0
+        && poolRetrieveObject(pool, kept[19]) != NULL)
+    {
+        fprintf(stderr, "SUCESS: Got '%d' collections with '%d' moves.\n", counts[GC_EVENT_END], counts[GC_EVENT_MOVE]);
+    }
+    else
+    {
+        testsFailed++;
+        fprintf(stderr, "FAILED: Events do not match the collection.\n");
+    }
+
+    deletePool(pool);
+}
+
+//------------------------------------------------------
+// testRecording
+//
+// PURPOSE: Testing that a recording pool writes its calls to the
+// recording in the order they were made, and stops when asked.
+//------------------------------------------------------
+void testRecording()
+{
+    testsExecuted++;
+    fprintf(stderr, "\nTesting the recording of the calls made on a pool.\n");
+
+    char path[] = "/tmp/recordingXXXXXX";
+    int fd = mkstemp(path);
+    ObjectPool* pool = createPool(16 * 1024);
+    char magic[RECORDING_MAGIC_SIZE];
+    PoolSetup setup;
+    PoolCall calls[8];
+    int count = 0;
+    Ref first;
+    Ref second;
+    Ref aligned;
+
+    close(fd);
+
+    memset(&setup, 0, sizeof(setup));
+    setPoolLargeObjectSize(pool, 4096);
+    setPoolRecording(pool, path);
+
+    first = poolInsertObject(pool, 100);
+    second = poolInsertObject(pool, 200);
+    poolRetrieveObject(pool, first);
+    poolAddReference(pool, first);
+    poolDropReference(pool, second);
+    poolCollectStep(pool, 0);
+    aligned = poolInsertAlignedObject(pool, 32, 64);
+    setPoolAlignment(pool, 16);
+
+    setPoolRecording(pool, NULL);
+
+    // not recorded any more
+    poolDropReference(pool, first);
+
+    FILE* in = fopen(path, "rb");
+
+    if (in != NULL)
+    {
+        if (fread(magic, 1, RECORDING_MAGIC_SIZE, in) == RECORDING_MAGIC_SIZE
+            && memcmp(magic, RECORDING_MAGIC, RECORDING_MAGIC_SIZE) == 0
+            && fread(&setup, sizeof(PoolSetup), 1, in) == 1)
+        {
+            count = (int) fread(calls, sizeof(PoolCall), 8, in);
+        }
+
+        fclose(in);
+    }
+
+    if (count == 7 && setup.size == 16 * 1024 && setup.largeObjectSize == 4096 && setup.nurseryBytes == 0
+        && calls[0].call == POOL_CALL_INSERT && calls[0].ref == first && calls[0].value == 100
+        && calls[1].call == POOL_CALL_INSERT && calls[1].ref == second && calls[1].value == 200
+        && calls[2].call == POOL_CALL_ADD_REFERENCE && calls[2].ref == first
+        && calls[3].call == POOL_CALL_DROP_REFERENCE && calls[3].ref == second
+        && calls[4].call == POOL_CALL_COLLECT_STEP && calls[4].value == 0
+        && calls[5].call == POOL_CALL_INSERT_ALIGNED && calls[5].ref == aligned && calls[5].value == 32 && calls[5].detail == 64
+        && calls[6].call == POOL_CALL_SET_ALIGNMENT && calls[6].value == 16
+        && calls[0].timestamp <= calls[4].timestamp)
+    {
+        fprintf(stderr, "SUCESS: Recorded '%d' calls.\n", count);
+    }
+    else
+    {
+        testsFailed++;
+        fprintf(stderr, "FAILED: Recorded '%d' calls, expected 7 in order.\n", count);
+    }
+
+    unlink(path);
+    deletePool(pool);
+}
+
+//------------------------------------------------------
+// testRecordingTracedInserts
+//
+// PURPOSE: Testing that the recording of a tracing pool says it traces
+// and keeps the slots of every traced insert.
+//------------------------------------------------------
+void testRecordingTracedInserts()
+{
+    testsExecuted++;
+    fprintf(stderr, "\nTesting the recording of a tracing pool.\n");
+
+    char path[] = "/tmp/recordingXXXXXX";
+    int fd = mkstemp(path);
+    ObjectPool* pool = createPool(16 * 1024);
+    char magic[RECORDING_MAGIC_SIZE];
+    PoolSetup setup;
+    PoolCall calls[4];
+    int count = 0;
+    Ref traced;
+
+    close(fd);
+
+    memset(&setup, 0, sizeof(setup));
+    setPoolTracing(pool, 1);
+    setPoolRecording(pool, path);
+
+    traced = poolInsertTracedObject(pool, 24, 2);
+
+    setPoolRecording(pool, NULL);
+
+    FILE* in = fopen(path, "rb");
+
+    if (in != NULL)
+    {
+        if (fread(magic, 1, RECORDING_MAGIC_SIZE, in) == RECORDING_MAGIC_SIZE
+            && fread(&setup, sizeof(PoolSetup), 1, in) == 1)
+        {
+            count = (int) fread(calls, sizeof(PoolCall), 4, in);
+        }
+
+        fclose(in);
+    }
+
+    if (count == 1 && setup.tracing == 1 && calls[0].call == POOL_CALL_INSERT_TRACED
+        && calls[0].ref == traced && calls[0].value == 24 && calls[0].detail == 2)
+    {
+        fprintf(stderr, "SUCESS: Recorded the traced insert with its '%d' slots.\n", calls[0].detail);
+    }
+    else
+    {
+        testsFailed++;
+        fprintf(stderr, "FAILED: Recorded '%d' calls, expected one traced insert of a tracing pool.\n", count);
+    }
+
+    unlink(path);
+    deletePool(pool);
+}
+
+//------------------------------------------------------
+// testTracedCycle
+//
+// PURPOSE: Testing that a tracing pool reclaims a cycle nothing points
+// to while keeping an object only reachable through a slot.
+//------------------------------------------------------
+void testTracedCycle()
+{
+    testsExecuted++;
+    fprintf(stderr, "\nTesting that tracing reclaims unreachable cycles.\n");
+
+    ObjectPool* pool = createPool(16 * 1024);
+    Ref root;
+    Ref child;
+    Ref first;
+    Ref second;
+    int keptUntilCollected;
+
+    setPoolTracing(pool, 1);
+
+    root = poolInsertTracedObject(pool, 64, 2);
+    child = poolInsertTracedObject(pool, 32, 0);
+    first = poolInsertTracedObject(pool, 64, 1);
+    second = poolInsertTracedObject(pool, 64, 1);
+
+    ((Ref*) poolRetrieveObject(pool, root))[0] = child;
+    ((Ref*) poolRetrieveObject(pool, first))[0] = second;
+    ((Ref*) poolRetrieveObject(pool, second))[0] = first;
+
+    poolDropReference(pool, child);
+    poolDropReference(pool, first);
+    poolDropReference(pool, second);
+
+    // nothing is freed before the collector has traced the pool
+    keptUntilCollected = poolRetrieveObject(pool, first) != NULL && poolRetrieveObject(pool, child) != NULL;
+
+    poolCollectStep(pool, 0);
+
+    Ref* slots = (Ref*) poolRetrieveObject(pool, root);
+
+    if (keptUntilCollected && slots != NULL && slots[0] == child && slots[1] == NULL_REF
+        && poolRetrieveObject(pool, child) != NULL
+        && poolRetrieveObject(pool, first) == NULL && poolRetrieveObject(pool, second) == NULL)
+    {
+        fprintf(stderr, "SUCESS: Reclaimed the cycle and kept the object the root points to.\n");
+    }
+    else
+    {
+        testsFailed++;
+        fprintf(stderr, "FAILED: Tracing kept the cycle or lost a reachable object.\n");
+    }
+
+    deletePool(pool);
+}
+
+//------------------------------------------------------
+// testParallelMark
+//
+// PURPOSE: Testing that marking with several threads keeps a long
+// chain reachable from one root and reclaims the cycles beside it.
+//------------------------------------------------------
+void testParallelMark()
+{
+    testsExecuted++;
+    fprintf(stderr, "\nTesting marking a pool with several threads.\n");
+
+    ObjectPool* pool = createPool(1024 * 1024);
+    PoolStats stats;
+    Ref head;
+    Ref last;
+    int cycles = 2000;
+    int chain = 10000;
+
+    setPoolTracing(pool, 1);
+    setPoolGcThreads(pool, 4);
+
+    head = poolInsertTracedObject(pool, 16, 1);
+    last = head;
+
+    for (int i = 0; i < chain; i++)
+    {
+        Ref next = poolInsertTracedObject(pool, 16, 1);
+
+        ((Ref*) poolRetrieveObject(pool, last))[0] = next;
+
+        if (last != head)
+        {
+            poolDropReference(pool, last);
+        }
+
+        last = next;
+    }
+
+    poolDropReference(pool, last);
+
+    for (int i = 0; i < cycles; i++)
+    {
+        Ref first = poolInsertTracedObject(pool, 16, 1);
+        Ref second = poolInsertTracedObject(pool, 16, 1);
+
+        ((Ref*) poolRetrieveObject(pool, first))[0] = second;
+        ((Ref*) poolRetrieveObject(pool, second))[0] = first;
+
+        poolDropReference(pool, first);
+        poolDropReference(pool, second);
+    }
+
+    poolCollectStep(pool, 0);
+    poolGetStats(pool, &stats);
+
+    if (stats.liveObjects == (unsigned long) chain + 1 && poolRetrieveObject(pool, last) != NULL)
+    {
+        fprintf(stderr, "SUCESS: Kept the '%lu' objects of the chain.\n", stats.liveObjects);
+    }
+    else
+    {
+        testsFailed++;
+        fprintf(stderr, "FAILED: Kept '%lu' objects, expected '%d'.\n", stats.liveObjects, chain + 1);
+    }
+
+    deletePool(pool);
+}
+
+//------------------------------------------------------
+// testParallelCompaction
+//
+// PURPOSE: Compacts a pool big enough to be slid by several threads and
+// checks the objects kept their contents and their freed room is reused.
+//------------------------------------------------------
+void testParallelCompaction()
+{
+    testsExecuted++;
+    fprintf(stderr, "\nTesting compacting a pool with several threads.\n");
+
+    ObjectPool* pool = createPool(1024 * 1024);
+    PoolStats stats;
+    Ref objects[4000];
+    int count = 4000;
+    int intact = 0;
+    int inserted = 0;
+
+    setPoolGcThreads(pool, 4);
+
+    for (int i = 0; i < count; i++)
+    {
+        objects[i] = poolInsertObject(pool, 200);
+        ((int*) poolRetrieveObject(pool, objects[i]))[0] = i;
+        ((int*) poolRetrieveObject(pool, objects[i]))[49] = i;
+    }
+
+    for (int i = 0; i < count; i += 2)
+    {
+        poolDropReference(pool, objects[i]);
+    }
+
+    poolCollectStep(pool, 0);
+    poolGetStats(pool, &stats);
+
+    for (int i = 1; i < count; i += 2)
+    {
+        int* object = (int*) poolRetrieveObject(pool, objects[i]);
+
+        if (object != NULL && object[0] == i && object[49] == i)
+        {
+            intact++;
+        }
+    }
+
+    for (int i = 0; i < count; i += 2)
+    {
+        if (poolInsertObject(pool, 200) != NULL_REF)
+        {
+            inserted++;
+        }
+    }
+
+    if (intact == count / 2 && inserted == count / 2 && stats.bytesMoved > 0)
+    {
+        fprintf(stderr, "SUCESS: Moved '%lu' bytes and kept all '%d' objects intact.\n", stats.bytesMoved, intact);
+    }
+    else
+    {
+        testsFailed++;
+        fprintf(stderr, "FAILED: '%d' of '%d' objects intact, '%d' inserted after, '%lu' bytes moved.\n",
+            intact, count / 2, inserted, stats.bytesMoved);
+    }
+
+    deletePool(pool);
+}
+
+//------------------------------------------------------
+// testHotGrouping
+//
+// PURPOSE: Retrieves every tenth object of a pool often and checks that
+// compacting moves them next to each other, keeping the order of the
+// rest and the contents of all.
+//------------------------------------------------------
+void testHotGrouping()
+{
+    testsExecuted++;
+    fprintf(stderr, "\nTesting grouping the hot objects of a pool.\n");
+
+    ObjectPool* pool = createPool(256 * 1024);
+    Ref objects[1000];
+    int count = 1000;
+    unsigned char* lowest = NULL;
+    unsigned char* highest = NULL;
+    int intact = 0;
+    int ordered = 1;
+
+    setPoolHotGrouping(pool, 1);
+
+    for (int i = 0; i < count; i++)
+    {
+        objects[i] = poolInsertObject(pool, 64);
+        ((int*) poolRetrieveObject(pool, objects[i]))[0] = i;
+    }
+
+    for (int pass = 0; pass < 10; pass++)
+    {
+        for (int i = 0; i < count; i += 10)
+        {
+            poolRetrieveObject(pool, objects[i]);
+        }
+    }
+
+    poolCollectStep(pool, 0);
+
+    for (int i = 0; i < count; i++)
+    {
+        unsigned char* object = (unsigned char*) poolRetrieveObject(pool, objects[i]);
+
+        if (((int*) object)[0] == i)
+        {
+            intact++;
+        }
+
+        if (i % 10 == 0)
+        {
+            lowest = lowest == NULL || object < lowest ? object : lowest;
+            highest = highest == NULL || object > highest ? object : highest;
+        }
+        else if (i % 10 > 1 && object < (unsigned char*) poolRetrieveObject(pool, objects[i - 1]))
+        {
+            ordered = 0;
+        }
+    }
+
+    // the hot objects take up a hundred blocks of a little over 64 bytes
+    if (intact == count && ordered && highest - lowest < 100 * 96)
+    {
+        fprintf(stderr, "SUCESS: The hot objects span '%ld' bytes.\n", (long) (highest - lowest));
+    }
+    else
+    {
+        testsFailed++;
+        fprintf(stderr, "FAILED: The hot objects span '%ld' bytes, '%d' objects intact, ordered '%d'.\n",
+            (long) (highest - lowest), intact, ordered);
+    }
+
+    deletePool(pool);
+}
+
+//------------------------------------------------------
+// testLargeObjects
+//
+// PURPOSE: Puts objects bigger than the pool itself into the large-object
+// space and checks collections leave them in place, a dropped one is
+// unmapped and a tracing pool sweeps one it can no longer reach.
+//------------------------------------------------------
+void testLargeObjects()
+{
+    testsExecuted++;
+    fprintf(stderr, "\nTesting the large-object space of a pool.\n");
+
+    ObjectPool* pool = createPool(64 * 1024);
+    PoolStats before;
+    PoolStats after;
+    Ref large;
+    Ref cycle;
+    unsigned char* object;
+    int failed = 0;
+
+    setPoolLargeObjectSize(pool, 16 * 1024);
+    setPoolTracing(pool, 1);
+
+    large = poolInsertObject(pool, 1024 * 1024);
+    object = (unsigned char*) poolRetrieveObject(pool, large);
+
+    memset(object, 0x5a, 1024 * 1024);
+
+    // enough small garbage that the pool collects a few times on its own
+    for (int i = 0; i < 1000; i++)
+    {
+        poolDropReference(pool, poolInsertObject(pool, 200));
+    }
+
+    // a large object that only points to itself is garbage to a tracing pool
+    cycle = poolInsertTracedObject(pool, 32 * 1024, 1);
+    ((Ref*) poolRetrieveObject(pool, cycle))[0] = cycle;
+    poolDropReference(pool, cycle);
+
+    poolGetStats(pool, &before);
+    poolCollectStep(pool, 0);
+    poolGetStats(pool, &after);
+
+    if (((unsigned long) object & 4095) != 0 || poolRetrieveObject(pool, large) != object
+        || object[0] != 0x5a || object[1024 * 1024 - 1] != 0x5a)
+    {
+        failed = 1;
+        fprintf(stderr, "FAILED: The large object moved or lost its contents.\n");
+    }
+
+    if (before.largeObjects != 2 || after.largeObjects != 1 || after.largeBytes != 1024 * 1024)
+    {
+        failed = 1;
+        fprintf(stderr, "FAILED: '%lu' large objects before collecting and '%lu' after, expected 2 and 1.\n",
+            before.largeObjects, after.largeObjects);
+    }
+
+    poolDropReference(pool, large);
+    poolCollectStep(pool, 0);
+    poolGetStats(pool, &after);
+
+    if (after.largeObjects != 0 || after.liveObjects != 0)
+    {
+        failed = 1;
+        fprintf(stderr, "FAILED: '%lu' objects left after dropping the large object.\n", after.liveObjects);
+    }
+
+    if (failed)
+    {
+        testsFailed++;
+    }
+    else
+    {
+        fprintf(stderr, "SUCESS: The large objects stayed put and were freed once garbage.\n");
+    }
+
+    deletePool(pool);
+}
+
+//------------------------------------------------------
+// testAlignedObjects
+//
+// PURPOSE: Inserts objects with alignments of their own and of the pool
+// between unaligned ones, and checks they are still aligned and intact
+// after the objects around them are collected.
+//------------------------------------------------------
+void testAlignedObjects()
+{
+    testsExecuted++;
+    fprintf(stderr, "\nTesting aligned objects.\n");
+
+    ObjectPool* pool = createPool(64 * 1024);
+    Ref aligned[200];
+    int alignments[200];
+    int count = 200;
+    int misaligned = 0;
+    int intact = 0;
+
+    for (int i = 0; i < count; i++)
+    {
+        Ref filler = poolInsertObject(pool, 8 + (i % 5) * 8);
+
+        alignments[i] = 16 << (i % 7);
+
+        // the last ones take the alignment of the pool
+        if (i == count / 2)
+        {
+            setPoolAlignment(pool, 64);
+        }
+
+        aligned[i] = i < count / 2 ? poolInsertAlignedObject(pool, 40, alignments[i]) : poolInsertObject(pool, 40);
+        alignments[i] = i < count / 2 ? alignments[i] : 64;
+        ((int*) poolRetrieveObject(pool, aligned[i]))[9] = i;
+
+        poolDropReference(pool, filler);
+    }
+
+    poolCollectStep(pool, 0);
+
+    for (int i = 0; i < count; i++)
+    {
+        int* object = (int*) poolRetrieveObject(pool, aligned[i]);
+
+        if (((unsigned long) object & (alignments[i] - 1)) != 0)
+        {
+            misaligned++;
+        }
+        else if (object[9] == i)
+        {
+            intact++;
+        }
+    }
+
+    if (misaligned == 0 && intact == count)
+    {
+        fprintf(stderr, "SUCESS: All '%d' objects stayed aligned.\n", count);
+    }
+    else
+    {
+        testsFailed++;
+        fprintf(stderr, "FAILED: '%d' objects misaligned and '%d' intact of '%d'.\n", misaligned, intact, count);
+    }
+
+    deletePool(pool);
+}
+
+//------------------------------------------------------
+// sparseTracingPool
+//
+// PURPOSE: Fills a tracing pool with objects, some of them large, drops
+// all but a few scattered over the handle table and collects it.
+// INPUT PARAMETERS:
+// vectors - Whether the pool scans its handle table with vectors
+// OUTPUT PARAMETERS:
+// stats - The stats of the pool after the collection
+// The number of words its scans skip at once.
+//------------------------------------------------------
+int sparseTracingPool(int vectors, PoolStats *stats)
+{
+    ObjectPool* pool = createPool(256 * 1024);
+    int width;
+
+    setPoolTracing(pool, 1);
+    setPoolLargeObjectSize(pool, 16 * 1024);
+    width = setPoolVectorScans(pool, vectors);
+
+    for (int i = 0; i < 6000; i++)
+    {
+        Ref ref = poolInsertTracedObject(pool, i % 700 == 350 ? 20 * 1024 : 24, 1);
+
+        // keep the ones at the edges of the words of the table and every other large one
+        if (!(i % 64 == 0 || i % 64 == 63 || i % 1400 == 350 || i == 5999))
+        {
+            poolDropReference(pool, ref);
+        }
+    }
+
+    poolCollectStep(pool, 0);
+    poolGetStats(pool, stats);
+
+    deletePool(pool);
+
+    return width;
+}
+
+//------------------------------------------------------
+// testVectorScans
+//
+// PURPOSE: Runs the same collection of a sparse tracing pool with the
+// scans of the handle table done a word at a time and with vectors,
+// and checks both keep the same objects.
+//------------------------------------------------------
+void testVectorScans()
+{
+    testsExecuted++;
+    fprintf(stderr, "\nTesting the vector scans of the handle table.\n");
+
+    PoolStats scalar;
+    PoolStats vector;
+    int kept = 0;
+    int keptLarge = 0;
+
+    for (int i = 0; i < 6000; i++)
+    {
+        if (i % 64 == 0 || i % 64 == 63 || i % 1400 == 350 || i == 5999)
+        {
+            kept++;
+            keptLarge += i % 700 == 350;
+        }
+    }
+
+    int scalarWidth = sparseTracingPool(0, &scalar);
+    int vectorWidth = sparseTracingPool(1, &vector);
+
+    fprintf(stderr, "INFO: The vector scans skip '%d' words at once.\n", vectorWidth);
+
+    if (scalarWidth == 1 && scalar.liveObjects == (unsigned long) kept && scalar.largeObjects == (unsigned long) keptLarge
+        && vector.liveObjects == scalar.liveObjects && vector.liveBytes == scalar.liveBytes
+        && vector.largeObjects == scalar.largeObjects && vector.lastBytesReclaimed == scalar.lastBytesReclaimed)
+    {
+        fprintf(stderr, "SUCESS: Both scans kept the same '%lu' objects.\n", vector.liveObjects);
+    }
+    else
+    {
+        testsFailed++;
+        fprintf(stderr, "FAILED: The scans kept '%lu' and '%lu' objects, expected '%d'.\n",
+            scalar.liveObjects, vector.liveObjects, kept);
+    }
+}
+
+//------------------------------------------------------
+// testSparseHandleTable
+//
+// PURPOSE: Leaves a few objects scattered over several slabs of the
+// handle table, some of them large, and checks the scans of the table
+// still find every one of them and only them.
+//------------------------------------------------------
+void testSparseHandleTable()
+{
+    testsExecuted++;
+    fprintf(stderr, "\nTesting a sparse handle table.\n");
+
+    ObjectPool* pool = createPool(256 * 1024);
+    Ref objects[5000];
+    PoolStats stats;
+    int count = 5000;
+    int kept = 0;
+    int keptLarge = 0;
+    int failed = 0;
+
+    setPoolLargeObjectSize(pool, 16 * 1024);
+
+    for (int i = 0; i < count; i++)
+    {
+        objects[i] = poolInsertObject(pool, i % 1000 == 500 ? 20 * 1024 : 16);
+    }
+
+    for (int i = 0; i < count; i++)
+    {
+        // keep the ones at the edges of the words and slabs of the table as well as the large ones
+        if (i % 1000 == 500 || i % 1024 == 0 || i % 1024 == 1023 || i % 64 == 63)
+        {
+            kept++;
+            keptLarge += i % 1000 == 500;
+        }
+        else
+        {
+            poolDropReference(pool, objects[i]);
+        }
+    }
+
+    // the large ones are all dropped but the last
+    for (int i = 500; i < count - 1000; i += 1000)
+    {
+        poolDropReference(pool, objects[i]);
+        kept--;
+        keptLarge--;
+    }
+
+    poolCollectStep(pool, 0);
+    poolGetStats(pool, &stats);
+
+    if (stats.liveObjects != (unsigned long) kept || stats.largeObjects != (unsigned long) keptLarge)
+    {
+        failed = 1;
+        fprintf(stderr, "FAILED: '%lu' objects and '%lu' large ones found, expected '%d' and '%d'.\n",
+            stats.liveObjects, stats.largeObjects, kept, keptLarge);
+    }
+
+    if (poolRetrieveObject(pool, objects[4095]) == NULL || poolRetrieveObject(pool, objects[4500]) == NULL)
+    {
+        failed = 1;
+        fprintf(stderr, "FAILED: A kept object can't be retrieved.\n");
+    }
+
+    if (failed)
+    {
+        testsFailed++;
+    }
+    else
+    {
+        fprintf(stderr, "SUCESS: Found all '%d' objects left in the table.\n", kept);
+    }
+
+    deletePool(pool);
+}
+
+//------------------------------------------------------
+// testInspectWhileHoldingAccess
+//
+// PURPOSE: Testing that a thread inside the access section of a
+// concurrent pool can still dump the pool and read its stats instead
+// of waiting on itself.
+//------------------------------------------------------
+void testInspectWhileHoldingAccess()
+{
+    testsExecuted++;
+    fprintf(stderr, "\nTesting a dump and stats while holding access to a concurrent pool.\n");
+
+    ObjectPool* pool = createPool(16 * 1024);
+    PoolStats stats;
+    setPoolConcurrent(pool, 1);
+
+    Ref ref = poolInsertObject(pool, 32);
+
+    beginPoolAccess(pool);
+    poolDump(pool);
+    poolGetStats(pool, &stats);
+    endPoolAccess(pool);
+
+    if (poolRetrieveObject(pool, ref) != NULL && stats.liveObjects == 1 && stats.liveBytes == 32)
+    {
+        fprintf(stderr, "SUCESS: Dumped the pool and read its stats from inside its access section.\n");
+    }
+    else
+    {
+        testsFailed++;
+        fprintf(stderr, "FAILED: Stats read inside the access section count '%lu' objects, expected 1.\n", stats.liveObjects);
+    }
+
+    deletePool(pool);
+}
+
+//------------------------------------------------------
+// countText
+//
+// PURPOSE: Counts how often a piece of text shows up in a file.
+//------------------------------------------------------
+static int countText(const char *path, const char *text)
+{
+    char contents[4096];
+    int count = 0;
+    FILE* in = fopen(path, "r");
+
+    if (in != NULL)
+    {
+        size_t length = fread(contents, 1, sizeof(contents) - 1, in);
+        const char* at = contents;
+
+        contents[length] = '\0';
+
+        while ((at = strstr(at, text)) != NULL)
+        {
+            count++;
+            at += strlen(text);
+        }
+
+        fclose(in);
+    }
+
+    return count;
+}
+
+//------------------------------------------------------
+// testTraceBuffer
+//
+// PURPOSE: Testing that a trace buffer that wrapped around drops the
+// end of a collection whose begin it lost, closes the collection still
+// open and keeps the absolute timestamps.
+//------------------------------------------------------
+void testTraceBuffer()
+{
+    testsExecuted++;
+    fprintf(stderr, "\nTesting the export of a trace buffer.\n");
+
+    char path[] = "/tmp/traceXXXXXX";
+    int fd = mkstemp(path);
+    TraceBuffer* trace = createTraceBuffer(3);
+    GcEvent events[4];
+    long written;
+
+    close(fd);
+    memset(events, 0, sizeof(events));
+
+    // the first event is overwritten, leaving the end of its collection without a begin
+    events[0].type = GC_EVENT_BEGIN;
+    events[0].timestamp = 1000;
+    events[0].kind = "GARBAGE COLLECTION";
+    events[1].type = GC_EVENT_END;
+    events[1].timestamp = 2000;
+    events[1].kind = "GARBAGE COLLECTION";
+    events[2].type = GC_EVENT_MOVE;
+    events[2].timestamp = 3000;
+    events[2].ref = 1;
+    events[3].type = GC_EVENT_BEGIN;
+    events[3].timestamp = 4000123;
+    events[3].kind = "MINOR COLLECTION";
+
+    for (int i = 0; i < 4; i++)
+    {
+        recordTraceEvent(&events[i], trace);
+    }
+
+    written = writeTraceBuffer(trace, path);
+
+    if (written == 3 && countText(path, "\"ph\":\"B\"") == 1 && countText(path, "\"ph\":\"E\"") == 1
+        && countText(path, "\"ts\":4000.123") == 2 && countText(path, "GARBAGE COLLECTION") == 0)
+    {
+        fprintf(stderr, "SUCESS: Wrote '%ld' events with every begin matched by an end.\n", written);
+    }
+    else
+    {
+        testsFailed++;
+        fprintf(stderr, "FAILED: Wrote '%ld' events, expected a move and one matched collection.\n", written);
+    }
+
+    unlink(path);
+    deleteTraceBuffer(trace);
+}
+
+//------------------------------------------------------
+// testGenerationalTracing
+//
+// PURPOSE: Testing that minor collections of a generational tracing pool
+// keep a young object only an old one points to, over several of them,
+// and still reclaim young garbage.
+//------------------------------------------------------
+void testGenerationalTracing()
+{
+    testsExecuted++;
+    fprintf(stderr, "\nTesting minor collections of a tracing pool.\n");
+
+    ObjectPool* pool = createPool(256 * 1024);
+    PoolStats stats;
+    Ref old;
+    Ref young;
+    Ref garbage;
+    int* object;
+
+    setPoolGenerational(pool, 16 * 1024, 3);
+    setPoolTracing(pool, 1);
+
+    old = poolInsertTracedObject(pool, 64, 1);
+
+    // enough garbage that the old object is promoted
+    for (int i = 0; i < 1000; i++)
+    {
+        poolDropReference(pool, poolInsertObject(pool, 200));
+    }
+
+    young = poolInsertTracedObject(pool, 32, 0);
+    garbage = poolInsertTracedObject(pool, 32, 0);
+    ((int*) poolRetrieveObject(pool, young))[7] = 1234;
+    ((Ref*) poolRetrieveObject(pool, old))[0] = young;
+    poolDropReference(pool, young);
+    poolDropReference(pool, garbage);
+
+    // the young object survives a few minor collections in the nursery before it is promoted
+    for (int i = 0; i < 1000; i++)
+    {
+        poolDropReference(pool, poolInsertObject(pool, 200));
+    }
+
+    object = (int*) poolRetrieveObject(pool, young);
+    poolGetStats(pool, &stats);
+
+    if (object != NULL && object[7] == 1234 && poolRetrieveObject(pool, garbage) == NULL
+        && stats.minorCollections >= 6 && stats.collections == stats.minorCollections)
+    {
+        fprintf(stderr, "SUCESS: Kept the object the old one points to over '%lu' minor collections.\n", stats.minorCollections);
+    }
+    else
+    {
+        testsFailed++;
+        fprintf(stderr, "FAILED: Minor collections lost the young object or kept garbage.\n");
+    }
+
+    deletePool(pool);
+}
+
+int main(int argc, char const *argv[])
+{
+    fprintf(stderr, "------------------------------------------------\n");
+    testInitalizePool();
+    fprintf(stderr, "------------------------------------------------\n");
+    testInsertEmpty();
+    fprintf(stderr, "------------------------------------------------\n");
+    testCompaction();
+    fprintf(stderr, "------------------------------------------------\n");
+    testCompactionKeepsData();
+    fprintf(stderr, "------------------------------------------------\n");
+    testInsertAndRetrive();
+    fprintf(stderr, "------------------------------------------------\n");
+    testInsertFull();
+    fprintf(stderr, "------------------------------------------------\n");
+    testInsertWholePool();
+    fprintf(stderr, "------------------------------------------------\n");
+    testRevialEmpty();
+    fprintf(stderr, "------------------------------------------------\n");
+    testAddReference();
+    fprintf(stderr, "------------------------------------------------\n");
+    testDropReference();
+    fprintf(stderr, "------------------------------------------------\n");
+    testStaleReference();
+    fprintf(stderr, "------------------------------------------------\n");
+    testManyObjects();
+    fprintf(stderr, "------------------------------------------------\n");
+    testIndependentPools();
+    fprintf(stderr, "------------------------------------------------\n");
+    testThreadLocalChunks();
+    fprintf(stderr, "------------------------------------------------\n");
+    testFreeListReuse();
+    fprintf(stderr, "------------------------------------------------\n");
+    testNurseryPromotion();
+    fprintf(stderr, "------------------------------------------------\n");
+    testIncrementalCompaction();
+    fprintf(stderr, "------------------------------------------------\n");
+    testBackgroundCollection();
+    fprintf(stderr, "------------------------------------------------\n");
+    testBatchInsert();
+    fprintf(stderr, "------------------------------------------------\n");
+    testPinnedObject();
+    fprintf(stderr, "------------------------------------------------\n");
+    testGrowablePool();
+    fprintf(stderr, "------------------------------------------------\n");
+    testReleaseTail();
+    fprintf(stderr, "------------------------------------------------\n");
+    testPoolStats();
+    fprintf(stderr, "------------------------------------------------\n");
+    testEventHook();
+    fprintf(stderr, "------------------------------------------------\n");
+    testRecording();
+    fprintf(stderr, "------------------------------------------------\n");
+    testRecordingTracedInserts();
+    fprintf(stderr, "------------------------------------------------\n");
+    testTracedCycle();
+    fprintf(stderr, "------------------------------------------------\n");
+    testParallelMark();
+    fprintf(stderr, "------------------------------------------------\n");
+    testParallelCompaction();
+    fprintf(stderr, "------------------------------------------------\n");
+    testHotGrouping();
+    fprintf(stderr, "------------------------------------------------\n");
+    testLargeObjects();
+    fprintf(stderr, "------------------------------------------------\n");
+    testAlignedObjects();
+    fprintf(stderr, "------------------------------------------------\n");
+    testSparseHandleTable();
+    fprintf(stderr, "------------------------------------------------\n");
+    testVectorScans();
+    fprintf(stderr, "------------------------------------------------\n");
+    testInspectWhileHoldingAccess();
+    fprintf(stderr, "------------------------------------------------\n");
+    testTraceBuffer();
+    fprintf(stderr, "------------------------------------------------\n");
+    testGenerationalTracing();
 
     printf("\nTotal number of tests executed: %d\n", testsExecuted);
     printf("Number of tests passed:         %d\n",
@@ -0,0 +1,132 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include "ObjectManager.h"
+
+// The pool starts small so it grows and collects during the run.
+#define TRACE_POOL_SIZE (256*1024)
+#define TRACE_POOL_MAXIMUM (4*1024*1024)
+#define TRACE_NURSERY_SIZE (64*1024)
+
+// Events kept in memory, once full the oldest ones are overwritten.
+#define RING_EVENTS (1 << 18)
+
+// Objects every thread keeps alive at once.
+#define KEPT_OBJECTS 64
+
+#define MAX_THREADS 64
+
+static ObjectPool *pool = NULL;
+static int operations = 100000;
+
+//------------------------------------------------------
+// nextRandom
+//
+// PURPOSE: A small xorshift generator so threads don't share rand() state.
+//------------------------------------------------------
+static unsigned long nextRandom(unsigned long *state)
+{
+    *state ^= *state << 13;
+    *state ^= *state >> 7;
+    *state ^= *state << 17;
+    return *state;
+}
+
+//------------------------------------------------------
+// worker
+//
+// PURPOSE: Churns objects through the pool, keeping a window of them
+// alive and now and then one for good, so the pool grows.
+//------------------------------------------------------
+static void *worker(void *arg)
+{
+    unsigned long random = 88172645463325252UL ^ ((unsigned long) arg * 2654435761UL);
+    Ref kept[KEPT_OBJECTS];
+    int next = 0;
+
+    memset(kept, 0, sizeof(kept));
+
+    for (int i = 0; i < operations; i++)
+    {
+        if (kept[next] != NULL_REF && nextRandom(&random) % 64 != 0)
+        {
+            poolDropReference(pool, kept[next]);
+        }
+
+        kept[next] = poolInsertObject(pool, 16 + (int) (nextRandom(&random) % 1000));
+        next = (next + 1) % KEPT_OBJECTS;
+    }
+
+    return NULL;
+}
+
+int main(int argc, char const *argv[])
+{
+    const char* path = "trace.json";
+    int threads = 2;
+    pthread_t workers[MAX_THREADS];
+
+    if (argc > 1)
+    {
+        path = argv[1];
+    }
+
+    if (argc > 2)
+    {
+        threads = atoi(argv[2]);
+    }
+
+    if (argc > 3)
+    {
+        operations = atoi(argv[3]);
+    }
+
+    if (threads < 1)
+    {
+        threads = 1;
+    }
+
+    if (threads > MAX_THREADS)
+    {
+        threads = MAX_THREADS;
+    }
+
+    TraceBuffer* trace = createTraceBuffer(RING_EVENTS);
+
+    if (trace == NULL)
+    {
+        return 1;
+    }
+
+    pool = createGrowablePool(TRACE_POOL_SIZE, TRACE_POOL_MAXIMUM);
+    setPoolConcurrent(pool, 1);
+    setPoolGenerational(pool, TRACE_NURSERY_SIZE, 2);
+    setPoolPauseBudget(pool, 100);
+    setPoolEventHook(pool, recordTraceEvent, trace);
+
+    for (long i = 0; i < threads; i++)
+    {
+        pthread_create(&workers[i], NULL, worker, (void*) (i + 1));
+    }
+
+    for (int i = 0; i < threads; i++)
+    {
+        pthread_join(workers[i], NULL);
+    }
+
+    deletePool(pool);
+
+    long written = writeTraceBuffer(trace, path);
+
+    deleteTraceBuffer(trace);
+
+    if (written < 0)
+    {
+        return 1;
+    }
+
+    fprintf(stderr, "Wrote %ld events to '%s'.\n", written, path);
+
+    return 0;
+}